@@ -30,6 +30,7 @@
 #define BLANK_PORT		PORTB	// Switch off all outputs and reset grayscale counter
 #define SIN_PORT		PORTB	// Write grayscale/dot correction data
 #define SCLK_PORT		PORTB	// Clock each bit of grayscale/dot correction data
+#define CHAIN_SIN_PORT	PORTC	// Write grayscale/dot correction data to each chain (NUM_CHAINS > 1), chain n on pin An
 #define HDSHK_PORT		PORTD	// Send handshake signal to confirm reception of advance/go back a cue command
 #define RCV_ADV_IN		PIND	// Receive advance a cue
 #define RCV_BAK_IN		PIND	// Receive go back a cue
@@ -45,15 +46,125 @@
 #define HDSHK			6		// Pin 6
 #define RCV_BAK			7		// Pin 7
 
+// ========= HARDWARE ABSTRACTION ======================================
+
+/*
+ * Everything below this section reaches the hardware only through these
+ * macros and through init_pins(), init_timers() and init_spi().
+ * 
+ * To run the code on something other than an AVR (e.g. against a simulated
+ * TLC5940 chain on a PC), define TLC_HAL_EXTERNAL and provide all of them
+ * yourself, along with the few Arduino basics used throughout (byte, _BV()
+ * millis() and micros(), plus free_ram() and Serial for BENCHMARK,
+ * PROFILE and DC_SERIAL).  With SHOW_SD, init_sd() and show_read() read the show from
+ * wherever suits, e.g. a file on the PC.
+ * GS_CYCLE_ISR() and SPI_ISR() just need to expand to function headers your
+ * simulation can call, from IRQ_WAIT() and wherever else it likes.
+ * host/ has one that runs on Linux against a model of the chain (see
+ * host/README.md).
+ */
+#ifndef TLC_HAL_EXTERNAL
+#include <avr/eeprom.h>
+
+// Serial data lines.  NB: SCLK_PORT == SIN_PORT, so these two can be
+// cleared in one go.
+#define SCLK_HIGH()			(SCLK_PORT |= _BV(SCLK))
+#define SCLK_LOW()			(SCLK_PORT &= ~_BV(SCLK))
+#define SCLK_SIN_LOW()		(SCLK_PORT &= ~(_BV(SCLK) | _BV(SIN)))
+#define SIN_HIGH()			(SIN_PORT |= _BV(SIN))
+// Sets the SIN of every chain at once, bit n for chain n.  The rest of
+// CHAIN_SIN_PORT is left as it is (no interrupt touches it, so reading it
+// back first is safe).
+#define CHAIN_SIN_WRITE(b)	(CHAIN_SIN_PORT = (CHAIN_SIN_PORT & ~CHAIN_SIN_MASK) | (b))
+#define XLAT_HIGH()			(XLAT_PORT |= _BV(XLAT))
+#define XLAT_LOW()			(XLAT_PORT &= ~_BV(XLAT))
+#define VPRG_HIGH()			(VPRG_PORT |= _BV(VPRG))
+#define VPRG_LOW()			(VPRG_PORT &= ~_BV(VPRG))
+#define BLANK_HIGH()		(BLANK_PORT |= _BV(BLANK))
+#define BLANK_LOW()			(BLANK_PORT &= ~_BV(BLANK))
+
+// GSCLK and BLANK are switched on and off by making their pins outputs/inputs
+#define GSCLK_TOGGLE()		(DDRD ^= _BV(GSCLK))
+#define BLANK_TOGGLE()		(DDRB ^= _BV(BLANK))
+
+// Cue advance/go back inputs and the handshake output
+#define ADVANCE_RECEIVED()	(RCV_ADV_IN & _BV(RCV_ADV))
+#define BACK_RECEIVED()		(RCV_BAK_IN & _BV(RCV_BAK))
+#define HDSHK_HIGH()		(HDSHK_PORT |= _BV(HDSHK))
+#define HDSHK_LOW()			(HDSHK_PORT &= ~_BV(HDSHK))
+
+// Interrupts.  GS_CYCLE_ISR runs at the end of every grayscale cycle,
+// SPI_ISR each time the SPI has sent a byte.
+#define INTERRUPTS_OFF()	cli()
+#define INTERRUPTS_ON()		sei()
+// Anything waiting on the interrupts spins on this, so a simulation can run
+// them from here
+#define IRQ_WAIT()			((void)0)
+#define GS_CYCLE_ISR()		ISR(TIMER1_COMPA_vect)
+#define GS_TIMER_RESTART()	(TCNT1 = 0)
+// System clock cycles since the end of the last grayscale cycle
+#define GS_TIMER_READ()		(TCNT1)
+#define SPI_ISR()			ISR(SPI_STC_vect)
+
+// SPI peripheral
+#define SPI_RUNNING()		(SPCR & _BV(SPE))
+#define SPI_WRITE(b)		(SPDR = (b))
+#define SPI_IRQ_ON()		(SPCR |= _BV(SPIE))
+#define SPI_IRQ_OFF()		(SPCR &= ~_BV(SPIE))
+// Hands SIN and SCLK back to their port bits (init_spi() takes them again)
+#define SPI_STOP()			(SPCR &= ~_BV(SPE))
+
+// EEPROM, which holds the dot correction table.  A write carries on by
+// itself for a few milliseconds after EEPROM_WRITE() returns, and another
+// can't start until EEPROM_READY().  EEPROM_UPDATE() only writes if the
+// byte is different, to save wearing out a byte written every power-up.
+#define EEPROM_SIZE			(E2END + 1)
+#define EEPROM_READ(a)		eeprom_read_byte((const uint8_t *)(a))
+#define EEPROM_WRITE(a, b)	eeprom_write_byte((uint8_t *)(a), (b))
+#define EEPROM_UPDATE(a, b)	eeprom_update_byte((uint8_t *)(a), (b))
+#define EEPROM_READY()		eeprom_is_ready()
+
+// A reading of an analogue input left unconnected, for its noise
+#define NOISE_READ()		analogRead(SEED_PIN)
+
+#endif
+
 // The order of the tricolour legs (L2R) to ensure the right colour comes on!
 #define RED_L			2
 #define GREEN_L			1
 #define BLUE_L			0
 
-// Controls the current through the LEDs of each colour
+// Controls the current through the LEDs of each colour (0 - 63), for
+// channels that haven't been given their own in EEPROM (see Dot Correction)
 #define RED_CURRENT		27
 #define GREEN_CURRENT	16
 #define BLUE_CURRENT	21
+// The per-channel dot correction table starts at DC_EEPROM in EEPROM.
+// Set DC_SERIAL to 1 to take a new one over serial (115200 baud) while the
+// show runs, either the values themselves after DC_REQUEST or measured
+// brightnesses to even out after DC_MEASURED.  It is sent to the chips as
+// soon as it's in.
+#define DC_EEPROM		0
+#define DC_SERIAL		0
+#define DC_REQUEST		'd'
+#define DC_MEASURED		'm'
+
+// Random numbers are seeded from RANDOM_SEED, or if that's 0 from the noise on
+// SEED_PIN (left unconnected), so every show is different (see Random
+// Numbers).  Give a seed to have the show play the same every time, e.g. to
+// replay or record one.
+// Set SEED_BOOTS to 1 to mix in a count of power-ups too, kept in 4 bytes at
+// SEED_EEPROM, in case the pin isn't noisy enough.  That writes to EEPROM
+// (only the bytes that change, mostly just the lowest) every time the board
+// starts, so wears that byte out after 100,000 or so power-ups.
+// SEED_PIN has to be a real pin with nothing on it: A5 is on every Uno, but
+// is chain 5's SIN with NUM_CHAINS 6; A6 and A7 are only on the surface
+// mount ATmega328 (Nano, Pro Mini), not the DIP-28 one on most Unos.
+#define RANDOM_SEED		0
+#define SEED_PIN		A5
+#define SEED_BOOTS		0
+#define SEED_EEPROM		(EEPROM_SIZE - 4)
+#define SEED_IN_EEPROM	(SEED_BOOTS && RANDOM_SEED == 0)
 
 // PWM frequency is given by f_0/(4096*GSCLK_PERIOD)
 // f_0 is the frequency of the system clock = 16MHz
@@ -67,6 +178,148 @@
 // Number of chips and LEDs to control
 #define NUM_TLC			2
 #define NUM_LED			9
+// Set FIXTURE_MAP to 1 to wire each LED to whichever channels suit, as listed
+// in FIXTURES (see below), rather than LED n on channels 3n to 3n + 2.
+#define FIXTURE_MAP		0
+// Channels kept in RAM, one for every output of the chain
+#define NUM_CHANNELS	(16*NUM_TLC)
+
+// LEAN_RAM 1 fits about twice as many chips in the same RAM as 0, at the
+// cost of a little more work each frame:
+// - dithered channels keep 4 bits of fraction rather than 8, and their
+//   left over error, in half a byte each, making 12 bits a channel
+// - fades keep only where each LED started from, when and how fast; how far
+//   each channel has to go is worked out again from where it's going
+// - grayscale data is packed and sent one chip at a time (GS_CHUNK_TLC)
+// The benchmarks print how much RAM each chip takes (see How many chips in
+// README.md).
+#define LEAN_RAM		1
+
+// loop() starts a new frame every FRAME_MS milliseconds, timed from when the
+// first one started, so the frame rate (and with it effect speeds and cue
+// timings) stays the same whatever the frames cost.  Frames that take
+// longer than that are counted in frame_overruns.
+#define FRAME_MS		8
+// Frames dropped because one ran long are still run through the show
+// (animate() only, not sent), so cues and effects keep time with the fades.
+// Up to CATCH_UP_FRAMES are caught up at once; after a longer stall the
+// show is that much behind.
+#define CATCH_UP_FRAMES	4
+// Set FRAME_REPORT_MS to print the frame counts (see wait_for_frame()) over
+// serial at 115200 baud every FRAME_REPORT_MS milliseconds, 0 for never.
+#define FRAME_REPORT_MS	0
+// Set PROFILE to 1 to time each stage of every frame and the grayscale cycle
+// interrupt, and count frames that don't get latched.  Whenever
+// PROFILE_REQUEST is received over serial (115200 baud) the results are
+// sent back as a binary record and started afresh (see Profiling).
+#define PROFILE			0
+#define PROFILE_REQUEST	'p'
+
+// Set to 1 to send grayscale data with the hardware SPI peripheral, which
+// drives SIN (pin 11, MOSI) and SCLK (pin 13, SCK) directly.
+// Set to 0 to bit-bang it out of SIN_PORT/SCLK_PORT instead.
+#define USE_SPI			1
+// Grayscale data is packed and shifted out GS_CHUNK_TLC chips at a time,
+// using 48 bytes of RAM per chip in a chunk (24 with USE_SPI 0).
+// With a whole chain's worth the next frame can be packed while the last is
+// still being shifted out or waiting to be latched.  With less, a frame
+// can't start going out until the last has been latched, but a long chain
+// doesn't need a copy of itself in RAM; the next chunk is packed while
+// the SPI is sending the one before.
+#define GS_CHUNK_TLC	(LEAN_RAM ? 1 : NUM_TLC)
+// The TLCs can be split into NUM_CHAINS chains of NUM_TLC/NUM_CHAINS chips,
+// up to 6 of them.  They share every line but SIN: chain n has its own on
+// pin An.  All the chains are shifted at once, so a frame goes out in the
+// time one chain takes.  Channels carry on from the end of one chain to the
+// start of the next.
+// The SPI only has the one SIN, so more than one chain needs USE_SPI 0.
+#define NUM_CHAINS		1
+#define CHAIN_TLC		(NUM_TLC / NUM_CHAINS)
+// The pins of CHAIN_SIN_PORT the chains use
+#define CHAIN_SIN_MASK	((1 << NUM_CHAINS) - 1)
+#if NUM_CHAINS > 1 && USE_SPI
+#error "NUM_CHAINS > 1 needs USE_SPI 0"
+#endif
+// Every chain the same length, and no further than A5 (PC6 is RESET)
+static_assert(NUM_CHAINS >= 1 && NUM_CHAINS <= 6 && NUM_TLC % NUM_CHAINS == 0,
+  "NUM_CHAINS has to be 1 to 6 and divide NUM_TLC");
+static_assert(RANDOM_SEED || NUM_CHAINS == 1 || SEED_PIN < A0 || SEED_PIN >= A0 + NUM_CHAINS,
+  "SEED_PIN is one of the chains' SIN pins; pick another or give a RANDOM_SEED");
+
+// Set to 1 to run the benchmarks (see the end of the file) over serial at
+// 115200 baud when the board starts, before the show begins.
+#define BENCHMARK		0
+// Number of frames each benchmark is run for
+#define BENCH_FRAMES	1000
+
+// Set RECORD_CUE to a cue number to record it as a clip (see Clips) when the
+// board starts.  It is run for RECORD_SKIP frames and then recorded for
+// RECORD_FRAMES frames, FRAME_MS apart, and printed over serial at
+// 115200 baud, ready to paste in with the others.
+// Skipping the start of a cue and recording a whole number of its cycles
+// gives a clip that loops without a jump.
+#define RECORD_CUE		0
+#define RECORD_SKIP		0
+#define RECORD_FRAMES	500
+// host/record does the same on a PC, for any cue of any show (see
+// host/README.md), without touching the board.
+// Set CLIP_DEMO to 1 to put two cues on the end of the show, one running a
+// pattern_shift and the next playing CLIP_PATTERN_SHIFT, the clip recorded
+// from it, so they can be compared.
+#define CLIP_DEMO		0
+
+// Set PREVIEW_CUES to a number of cues to preview cues 1 to PREVIEW_CUES
+// when the board starts: each is run for PREVIEW_FRAMES frames on a made up
+// clock, as fast as it will go, and every frame is sent over serial at
+// PREVIEW_BAUD as raw RGB, PREVIEW_WIDTH LEDs to a row (see Preview).
+#define PREVIEW_CUES	0
+#define PREVIEW_FRAMES	750
+#define PREVIEW_WIDTH	NUM_LED
+#define PREVIEW_BAUD	1000000
+
+// Where the show (the cue list, see Cue List) is read from:
+// SHOW_FLASH - CUE_STEPS, compiled into the sketch
+// SHOW_SD - SHOW_FILE on an SD card, with its CS on SD_CS.  It shares MOSI
+//           and SCK with the TLCs' SIN and SCLK, and needs MISO (pin 12).
+//           If there's no card or the file is no good, CUE_STEPS is played
+//           instead.  A card without the file gets CUE_STEPS written to it,
+//           as a starting point; host/showc makes one from a text show.
+#define SHOW_FLASH		0
+#define SHOW_SD			1
+#define SHOW_SOURCE		SHOW_FLASH
+#define SD_CS			8		// Pin 8
+#define SHOW_FILE		"SHOW.BIN"
+
+#if SHOW_SOURCE == SHOW_SD && !defined(TLC_HAL_EXTERNAL)
+#include <SD.h>
+#endif
+
+// Effects give their fade speeds as the step taken per frame, which is how
+// fades used to work.  Fades now run on the clock instead, and this is how
+// many milliseconds each of those steps is stretched to.
+#define FADE_STEP_MS	FRAME_MS
+// Set to 1 to have perform_fades() work on all the channels of an LED per
+// sum, packed into a 64 bit word.  0 does them one at a time, the same sums
+// but slower; it's there as a reference.
+#define FADE_SWAR		1
+// Built for a PC with SSE2 (e.g. the host build), FADE_SWAR does the sums in
+// an SSE2 register instead.  0 keeps to the plain C.
+#define FADE_SSE2		1
+
+#if FADE_SWAR && FADE_SSE2 && defined(__SSE2__)
+#include <emmintrin.h>
+#define FADE_ON_SSE2	1
+#else
+#define FADE_ON_SSE2	0
+#endif
+// How many effects can run at once, each on its own LEDs (see Effect
+// Instances).  Each one takes about 70 bytes of RAM.
+#define NUM_EFFECTS		3
+// 1 gives each effect instance a layer of its own, blended with the ones
+// below it by the step's blend mode (see Layers).  0 has the effects write
+// straight into the frame, over each other.  Costs 3*NUM_EFFECTS + 1 bytes
+// of RAM per LED, which is why it's off unless the show needs it.
+#define LAYERS			0
 
 // Design #defines to assist FX programming
 // Colours
@@ -84,39 +337,280 @@
 
 // Lookup table to account for the non-linear realationship between
 // absolute brightness and perceived brightness.
-// Reduces PWM to 8 bit, but fading is smoother.
-const unsigned int PWM_VALUE[] = {0,1,3,5,7,9,11,12,14,20,21,22,23,25,26,27,29,
-  31,32,34,36,37,39,41,43,45,47,49,52,54,56,59,61,64,66,69,72,75,77,80,83,87,90,
-  93,96,100,103,107,111,115,118,122,126,131,135,139,144,148,153,157,162,167,172,
-  177,182,187,193,198,204,209,215,221,227,233,239,246,252,259,265,272,279,286,293,
-  300,308,315,323,330,338,346,354,362,371,379,388,396,405,414,423,432,442,451,461,
-  470,480,490,501,511,521,532,543,553,564,576,587,598,610,622,634,646,658,670,683,
-  695,708,721,734,748,761,775,788,802,816,831,845,860,874,889,904,920,935,951,966,
-  982,999,1015,1031,1048,1065,1082,1099,1116,1134,1152,1170,1188,1206,1224,1243,1262,
-  1281,1300,1320,1339,1359,1379,1399,1420,1440,1461,1482,1503,1525,1546,1568,1590,
-  1612,1635,1657,1680,1703,1726,1750,1774,1797,1822,1846,1870,1895,1920,1945,1971,
-  1996,2022,2048,2074,2101,2128,2155,2182,2209,2237,2265,2293,2321,2350,2378,2407,
-  2437,2466,2496,2526,2556,2587,2617,2648,2679,2711,2743,2774,2807,2839,2872,2905,
-  2938,2971,3005,3039,3073,3107,3142,3177,3212,3248,3283,3319,3356,3392,3429,3466,
-  3503,3541,3578,3617,3655,3694,3732,3772,3811,3851,3891,3931,3972,4012,4054,4095};
-
-// Index variable
-unsigned int loop_var = 0;
+// Reduces PWM to 8 bit, but fading is smoother.  PWM_DITHER gets the lost
+// resolution back.
+// The table is worked out by the compiler from the curve below and lives in
+// flash, so it costs no RAM.  Read it with pgm_read_word().
+// Entries are 12.4 fixed point: the 12 bit PWM value plus 4 bits of fraction,
+// which are either rounded off or, with PWM_DITHER, carried over to the next frame.
+// Curves:
+// CURVE_CIE - CIE 1931 lightness (L*), which is what the old hand made table was
+// CURVE_GAMMA - (level/255)^GAMMA
+#define CURVE_CIE			0
+#define CURVE_GAMMA			1
+#define BRIGHTNESS_CURVE	CURVE_CIE
+#define GAMMA				2.2
+#define PWM_FRACTION_BITS	4
+
+#if BRIGHTNESS_CURVE == CURVE_CIE
+#define CIE_L(i)			((i) * 100.0 / 255)
+#define CURVE(i)			(CIE_L(i) <= 8 ? CIE_L(i) / 903.3 \
+							: pow((CIE_L(i) + 16) / 116, 3))
+#else
+#define CURVE(i)			pow((i) / 255.0, GAMMA)
+#endif
+#define PWM_ENTRY(i)		(unsigned int)(CURVE(i) * (4095UL << PWM_FRACTION_BITS) + 0.5)
+#define PWM_ENTRY4(i)		PWM_ENTRY(i), PWM_ENTRY(i + 1), PWM_ENTRY(i + 2), PWM_ENTRY(i + 3)
+#define PWM_ENTRY16(i)		PWM_ENTRY4(i), PWM_ENTRY4(i + 4), PWM_ENTRY4(i + 8), PWM_ENTRY4(i + 12)
+#define PWM_ENTRY64(i)		PWM_ENTRY16(i), PWM_ENTRY16(i + 16), PWM_ENTRY16(i + 32), PWM_ENTRY16(i + 48)
+
+const unsigned int PWM_VALUE[256] PROGMEM = {
+  PWM_ENTRY64(0), PWM_ENTRY64(64), PWM_ENTRY64(128), PWM_ENTRY64(192)
+};
+
+// The curve is only sums on constants, which GCC works out while compiling
+// even through pow().  static_assert needs them worked out too, so these
+// stop the build if a compiler can't (rather than the table being left to
+// the board to fill in at start up), as well as if the curve goes wrong.
+#define PWM_ENTRY_ROUNDED(i)	((PWM_ENTRY(i) + (1 << (PWM_FRACTION_BITS - 1))) >> PWM_FRACTION_BITS)
+static_assert(PWM_ENTRY(0) == 0 && PWM_ENTRY(255) == 4095UL << PWM_FRACTION_BITS,
+  "PWM_VALUE has to run from 0 to 4095");
+static_assert(PWM_ENTRY(64) < PWM_ENTRY(128) && PWM_ENTRY(128) < PWM_ENTRY(192),
+  "PWM_VALUE has to go up");
+#if BRIGHTNESS_CURVE == CURVE_CIE
+// The same as the old hand made table
+static_assert(PWM_ENTRY_ROUNDED(64) == 182 && PWM_ENTRY_ROUNDED(128) == 761
+  && PWM_ENTRY_ROUNDED(192) == 1996, "PWM_VALUE isn't the CIE curve");
+#endif
+
+// Fixtures: which channel each leg of each LED is wired to.
+// Everything works on an LED's legs as lanes, lane n being the LED's
+// channel 3*led + n when there's no map (so lane RED_L is the red leg).
+// FIXTURES has a fixture for every LED in that order: how many legs it has
+// and the channel of each lane, a table the compiler lays out, so finding a
+// channel is one read from flash.  Write each LED as one of:
+// RGB_FIXTURE(first) - an RGB LED on three channels in a row, legs in the
+//   usual order
+// FIXTURE(r, g, b) - one with its legs on channels r, g and b, wherever they
+//   are
+// MONO_FIXTURE(channel) - a single colour LED, or one leg of a part used one
+//   (e.g. the white of an RGBW, as an LED of its own), on the one channel.
+//   It's driven by the red it's given, and reads back its level as all
+//   three colours, so it costs no more RAM than the channel.
+// There has to be one for each of the NUM_LED LEDs, and a channel past the
+// end of the chain stops the build at fixture_off_the_chain().
+struct fixture {
+  byte legs;
+  unsigned int channel[3];
+};
+
+// The channel as it is if it's on the chain
+#define FIXTURE_ON_CHAIN(c)	((c) < NUM_CHANNELS ? (c) : fixture_off_the_chain())
+#define FIXTURE_LANE(lane, r, g, b)	\
+  FIXTURE_ON_CHAIN((lane) == RED_L ? (r) : (lane) == GREEN_L ? (g) : (b))
+#define FIXTURE_LEGS(legs, r, g, b)	\
+  {legs, {FIXTURE_LANE(0, r, g, b), FIXTURE_LANE(1, r, g, b), FIXTURE_LANE(2, r, g, b)}}
+#define FIXTURE(r, g, b)	FIXTURE_LEGS(3, r, g, b)
+#define RGB_FIXTURE(first)	FIXTURE((first) + RED_L, (first) + GREEN_L, (first) + BLUE_L)
+#define MONO_FIXTURE(c)		FIXTURE_LEGS(1, c, c, c)
+// Whether a lane has a leg of its own: a fixture has its legs in the order
+// red, green, blue, and the ones it's missing share the red's channel
+#define LANE_ORDER(lane)	((lane) == RED_L ? 0 : (lane) == GREEN_L ? 1 : 2)
+
+#if FIXTURE_MAP
+// Never defined: only the compiler ever gets as far as calling it
+unsigned int fixture_off_the_chain();
+
+constexpr struct fixture FIXTURES[] PROGMEM = {
+  RGB_FIXTURE(0), RGB_FIXTURE(3), RGB_FIXTURE(6), RGB_FIXTURE(9),
+  RGB_FIXTURE(12), RGB_FIXTURE(15), RGB_FIXTURE(18), RGB_FIXTURE(21),
+  RGB_FIXTURE(24)
+#if NUM_LED == 12
+  // e.g. the 5 channels left over as one more RGB LED and two single colour
+  // ones
+  , RGB_FIXTURE(27), MONO_FIXTURE(30), MONO_FIXTURE(31)
+#endif
+};
+static_assert(sizeof(FIXTURES) / sizeof(FIXTURES[0]) == NUM_LED,
+  "FIXTURES has to have a fixture for each of the NUM_LED LEDs");
+
+#define LED_CHANNEL(led, lane)	pgm_read_word(&FIXTURES[led].channel[lane])
+#define LED_HAS_LANE(led, lane)	(LANE_ORDER(lane) < pgm_read_byte(&FIXTURES[led].legs))
+
+// And the other way round: the lane of each channel, 2 bits a channel,
+// filled in by init_lanes() (see channel_lane())
+byte channel_lanes[(NUM_CHANNELS + 3) / 4];
+#else
+#define LED_CHANNEL(led, lane)	(3*(led) + (lane))
+#define LED_HAS_LANE(led, lane)	1
+#endif
+
+// What the LED's missing legs are given: its red, so they read back as they
+// were set rather than writing over the red's channel
+#define FIXTURE_COLOUR(led, R, G, B)	do { \
+    if (!LED_HAS_LANE(led, GREEN_L)) G = R; \
+    if (!LED_HAS_LANE(led, BLUE_L)) B = R; \
+  } while (0)
+
+// Set to 1 to dither each channel over successive frames rather than round
+// its PWM value off.  Channels are then 8.8 fixed point (fades keep the
+// fraction as well), which is looked up as a 12.4 value between two table
+// entries.  The 12 bit part is sent and the 4 bit remainder is added on to the
+// channel's next frame (error diffusion), so the average over a few frames
+// comes out at the full 16 bit target and slow fades at the bottom end
+// don't step.
+// It only dithers while the channels are changing: the dithering moves on
+// a frame at a time (every FRAME_MS), which at the bottom end can be seen
+// as flicker if it's kept up.  Once nothing changes, one more frame is sent
+// rounded off and left on the chips, and frames are skipped as they are
+// without dithering.
+// Costs 2 bytes of RAM per channel (1 with LEAN_RAM).
+#define PWM_DITHER			0
+
 // Flag indicating whether there is data in the serial register
 // waiting to be latched into the grayscale register
-byte data_waiting = 0;
+volatile byte data_waiting = 0;
 
 // grayscale_values holds the current values in the grayscale register
-byte grayscale_values[16*NUM_TLC];
+byte grayscale_values[NUM_CHANNELS];
+#if PWM_DITHER
+#if LEAN_RAM
+// As below, but two channels to a byte (see nibble_get()), and just the top
+// 4 bits of the fraction
+byte grayscale_fraction[(NUM_CHANNELS + 1) / 2];
+byte dither_error[(NUM_CHANNELS + 1) / 2];
+#define FRACTION_MASK				0xF0
+#define GET_FRACTION(channel)		(nibble_get(grayscale_fraction, channel) << 4)
+#define SET_FRACTION(channel, f)	nibble_set(grayscale_fraction, channel, (f) >> 4)
+#define GET_DITHER_ERROR(channel)	nibble_get(dither_error, channel)
+#define SET_DITHER_ERROR(channel, e)	nibble_set(dither_error, channel, e)
+#else
+// Fractional part of each channel, out of 256
+byte grayscale_fraction[NUM_CHANNELS];
+// What each channel has left over, in 16ths of a PWM step, to add on to
+// its next frame
+byte dither_error[NUM_CHANNELS];
+#define FRACTION_MASK				0xFF
+#define GET_FRACTION(channel)		grayscale_fraction[channel]
+#define SET_FRACTION(channel, f)	(grayscale_fraction[channel] = (f))
+#define GET_DITHER_ERROR(channel)	dither_error[channel]
+#define SET_DITHER_ERROR(channel, e)	(dither_error[channel] = (e))
+#endif
+// Non-zero when the frame last sent was dithered, so once the channels
+// stop changing there's still one to send, rounded off
+byte gs_dithering = 0;
+#endif
+
+// gs_data holds a chunk (see GS_CHUNK_TLC) of grayscale_values after the
+// PWM_VALUE lookup, packed 12 bits per channel exactly as they are shifted
+// into the TLCs: last channel first, MSB first.  Every pair of channels
+// fills 3 bytes.
+// With SPI there are two chunks so the next one can be packed while the SPI
+// interrupt is still shifting out (or waiting to latch) the one in
+// gs_data[gs_front].
+byte gs_data[1 + USE_SPI][24*GS_CHUNK_TLC];
+volatile byte gs_front = 0;
+// Set when the back buffer holds a chunk that hasn't started shifting yet,
+// to GS_LAST if it's the end of the frame, otherwise GS_MORE
+volatile byte gs_pending = 0;
+// How many bytes of the back buffer the pending chunk fills
+volatile unsigned int gs_pending_bytes = 0;
+// Set while the SPI interrupt is shifting out gs_data[gs_front], to what
+// gs_pending was for it
+volatile byte gs_shifting = 0;
+volatile byte *gs_next_byte;
+volatile unsigned int gs_bytes_left = 0;
+
+#define GS_MORE			1
+#define GS_LAST			2
+
+// Non-zero when grayscale_values has changed since it was last sent.
+// Set by channel_set(), cleared by write_gs_data().
+byte gs_dirty = 1;
+// How many frames write_gs_data() has sent, and how many it skipped
+// because nothing had changed
+unsigned long gs_frames_sent = 0;
+unsigned long gs_frames_skipped = 0;
+
+#define FRAME_US		(FRAME_MS * 1000UL)
+
+// When the current frame was due to start and when it actually did (micros())
+unsigned long frame_due_us = 0;
+unsigned long frame_start_us = 0;
+// How many frames have run, how many of them ran past the time the next
+// one was due, and how many frames were dropped altogether because of it
+unsigned long frames_run = 0;
+unsigned long frame_overruns = 0;
+unsigned long frames_dropped = 0;
+// Dropped frames the show has still to catch up (see CATCH_UP_FRAMES)
+byte frames_behind = 0;
+// The longest any frame has taken, in microseconds
+unsigned long frame_worst_us = 0;
+
+#if PROFILE
+// The stages of a frame that are timed (see Profiling).  The first four are
+// in microseconds, PROFILE_ISR in system clock cycles.
+#define PROFILE_ANIMATE		0
+#define PROFILE_FADES		1
+#define PROFILE_UPLOAD		2
+#define PROFILE_FRAME		3
+#define PROFILE_ISR			4
+#define PROFILE_STAGES		5
+#define PROFILE_STAGE(s)	profile_stage(s)
+
+// Frames latched by reset_counter(), frames thrown away before they could
+// be, and times write_gs_data() had to wait for the last frame to go out
+volatile unsigned long gs_latches = 0;
+unsigned long gs_latches_dropped = 0;
+unsigned long gs_upload_stalls = 0;
+// The most cycles the grayscale cycle interrupt has been late getting in,
+// the most it has taken, and what it took last time
+volatile unsigned int isr_latency_max = 0;
+volatile unsigned int isr_cycles_max = 0;
+volatile unsigned int isr_cycles_last = 0;
+#else
+#define PROFILE_STAGE(s)
+#endif
 
 // ========= SETUP FUNCTIONS ===========================================
 
 // stands for Interrupt Service Routine
 // This is called at the end of every grayscale cycle by a hardware level interrupt
-ISR(TIMER1_COMPA_vect) {
+GS_CYCLE_ISR() {
+#if PROFILE
+  unsigned int entered = GS_TIMER_READ();
+  unsigned int took;
+#endif
   reset_counter();
+#if PROFILE
+  // Kept to the bare minimum, as this runs 3900 times a second
+  took = GS_TIMER_READ() - entered;
+  if (entered > isr_latency_max) {
+    isr_latency_max = entered;
+  }
+  if (took > isr_cycles_max) {
+    isr_cycles_max = took;
+  }
+  isr_cycles_last = took;
+#endif
   // Set value in timer register to 0 to avoid BLANK and GSCLK getting out of sync
-  TCNT1 = 0;
+  GS_TIMER_RESTART();
+}
+
+#ifndef TLC_HAL_EXTERNAL
+// Assigns pin modes:  (Leaving pin 3 & 10 off since I don't want the 
+// grayscale and blank clocks to start yet)
+void init_pins() {
+  DDRD |= _BV(VPRG) | _BV(HDSHK) & ~_BV(RCV_ADV) & ~_BV(RCV_BAK);
+  DDRB |= _BV(XLAT) | _BV(SIN) | _BV(SCLK);
+#if NUM_CHAINS > 1
+  DDRC |= CHAIN_SIN_MASK;
+  PORTC &= ~CHAIN_SIN_MASK;
+#endif
+  
+  // Set outputs to initial desired states (i.e. all low)
+  PORTD &= B00000000;
+  PORTB &= B11000000;
 }
 
 // Initialises the timers used for BLANK and GSCLK
@@ -154,70 +648,151 @@ void init_timers() {
   // Enable global interrupts
   sei();
 }
+#endif
 
-// Writes dot correction data to TLC for the green, red and blue LEDs
-void write_dc_data(byte red_val, byte green_val, byte blue_val) {
+// Writes dot correction data (see dc_value()) to the TLCs.
+// Only call it while no grayscale data is on its way in (see update_dc()).
+void write_dc_data() {
+#if NUM_CHAINS > 1
+  // The 6 bit value for the channel being sent, one per chain
+  byte dc[NUM_CHAINS];
+#else
+  unsigned int channels;
+#endif
+  
   // VPRG high for dot correction programming mode
-  VPRG_PORT |= _BV(VPRG);
-  
-  for (loop_var = 0; loop_var < NUM_TLC * 16 * 6; loop_var ++) {	
-	// SCLK low and prepare SIN for data
-	// NB: SCLK_PORT == SIN_PORT
-	SCLK_PORT &= ~(_BV(SCLK) | _BV(SIN));
-	// Send next byte of data
-	if ((NUM_TLC*16 - loop_var/6 - 1)%3 == RED_L) {
-	  if (red_val & (32 >> (loop_var%6))) {
-	    SIN_PORT |= _BV(SIN);
-	  }
-    } else if ((NUM_TLC*16 - loop_var/6 - 1)%3 == GREEN_L) {
-	  if (green_val & (32 >> (loop_var%6))) {
-	    SIN_PORT |= _BV(SIN);
-	  }
-    } else {
-	  if (blue_val & (32 >> (loop_var%6))) {
-	    SIN_PORT |= _BV(SIN);
+  VPRG_HIGH();
+  
+#if NUM_CHAINS > 1
+  // Last channel first, MSB first
+  for (unsigned int channel = 16*CHAIN_TLC; channel-- > 0; ) {
+	for (byte chain = 0; chain < NUM_CHAINS; chain++) {
+	  dc[chain] = dc_value(chain*16*CHAIN_TLC + channel);
+	}
+	for (byte bit = 32; bit; bit >>= 1) {
+	  // SCLK low and prepare SIN for data
+	  // NB: SCLK_PORT == SIN_PORT
+	  SCLK_SIN_LOW();
+	  // Send next bit of data
+	  byte slice = 0;
+	  for (byte chain = 0; chain < NUM_CHAINS; chain++) {
+	    if (dc[chain] & bit) {
+	      slice |= _BV(chain);
+	    }
 	  }
-    }
-    // SCLK high - clock the bit into the input register
-    SCLK_PORT |= _BV(SCLK);
+	  CHAIN_SIN_WRITE(slice);
+      // SCLK high - clock the bit into the input register
+      SCLK_HIGH();
+	}
   }
   // Leave SCLK low
-  SCLK_PORT &= ~_BV(SCLK);
+  SCLK_LOW();
+#else
+  // Packed a chunk at a time into gs_data, which isn't needed for anything
+  // else until the next grayscale frame
+  for (unsigned int end = 16*NUM_TLC; end > 0; end -= channels) {
+    channels = min(end, 16*GS_CHUNK_TLC);
+    pack_dc_data(gs_data[0], end, channels);
+    bitbang_shift_out(gs_data[0], channels / 4 * 3);
+  }
+#endif
 	
   // Latch data into the DC registers
-  XLAT_PORT |= _BV(XLAT);
-  XLAT_PORT &= ~_BV(XLAT);
+  XLAT_HIGH();
+  XLAT_LOW();
 
   // VPRG low for grayscale programming mode
-  VPRG_PORT &= ~_BV(VPRG);
+  VPRG_LOW();
   
   // Sends an extra clock pulse.
   // Data sheet says this needs to happen to complete the grayscale
   // cycle whenever DC values have been written.  Not sure why.
-  SCLK_PORT |= _BV(SCLK);
-  SCLK_PORT &= ~_BV(SCLK);
+  SCLK_HIGH();
+  SCLK_LOW();
 }
 
-void setup() {
-  // Assign pin modes:  (Leaving pin 3 & 10 off since I don't want the 
-  // grayscale and blank clocks to start yet)
-  DDRD |= _BV(VPRG) | _BV(HDSHK) & ~_BV(RCV_ADV) & ~_BV(RCV_BAK);
-  DDRB |= _BV(XLAT) | _BV(SIN) | _BV(SCLK);
+// As pack_gs_data(), but the 6 bit dot correction values, so every four
+// channels (n, n-1, n-2, n-3) become the three bytes
+// n[5:0]|(n-1)[5:4], (n-1)[3:0]|(n-2)[5:2], (n-2)[1:0]|(n-3)[5:0]
+void pack_dc_data(byte *data, unsigned int end, unsigned int channels) {
+  byte dc[4];
   
-  // Set outputs to initial desired states (i.e. all low)
-  PORTD &= B00000000;
-  PORTB &= B11000000;
+  for (unsigned int channel = end; channel > end - channels; channel -= 4) {
+    for (byte n = 0; n < 4; n++) {
+      dc[n] = dc_value(channel - n - 1);
+    }
+    *data++ = (dc[0] << 2) | (dc[1] >> 4);
+    *data++ = (dc[1] << 4) | (dc[2] >> 2);
+    *data++ = (dc[2] << 6) | dc[3];
+  }
+}
+
+// Which lane (RED_L, GREEN_L or BLUE_L) of its LED a channel is wired to.
+// Channels no fixture uses are taken to be in the usual order.
+// With FIXTURE_MAP it's looked up in channel_lanes, as the preview and the
+// dot correction want it for every channel every frame.
+byte channel_lane(unsigned int channel) {
+#if FIXTURE_MAP
+  return (channel_lanes[channel >> 2] >> (2 * (channel & 3))) & 3;
+#else
+  return channel % 3;
+#endif
+}
+
+// Fills in channel_lanes from FIXTURES.  Working back through the map, so
+// a channel on more than one leg gets the first, as it did when the map
+// was searched.  A fixture's missing legs aren't wired to anything.
+void init_lanes() {
+#if FIXTURE_MAP
+  for (unsigned int channel = 0; channel < NUM_CHANNELS; channel++) {
+    set_channel_lane(channel, channel % 3);
+  }
+  for (unsigned int led = NUM_LED; led-- > 0; ) {
+    for (byte lane = 3; lane-- > 0; ) {
+      if (LED_HAS_LANE(led, lane)) {
+        set_channel_lane(LED_CHANNEL(led, lane), lane);
+      }
+    }
+  }
+#endif
+}
+
+#if FIXTURE_MAP
+void set_channel_lane(unsigned int channel, byte lane) {
+  byte shift = 2 * (channel & 3);
+  
+  channel_lanes[channel >> 2] = (channel_lanes[channel >> 2] & ~(3 << shift)) | (lane << shift);
+}
+#endif
+
+void setup() {
+#if SHOW_SOURCE == SHOW_SD
+  // Before anything else, as the SD library takes over some of the pins
+  open_show(init_sd());
+#endif
+  // Assign pin modes and set outputs low
+  init_pins();
 
   // Initialise timers
   init_timers();
   
-  // Write dot correction data for red, green and blue (respectively)
-  write_dc_data(RED_CURRENT, GREEN_CURRENT, BLUE_CURRENT);
+  seed_random();
+  
+  // Before anything wants the lane of a channel
+  init_lanes();
+  
+  // Write dot correction data, from EEPROM if it's there
+  load_dc();
+  write_dc_data();
   // Send grayscale data to TLC
   write_gs_data();
   // Enable grayscale clock and blank
   toggle_gsclk();
   toggle_blank();
+#if USE_SPI
+  // Only now that BLANK (the SPI SS pin) is an output
+  init_spi();
+#endif
   // Start grayscale cycle
   reset_counter();
   
@@ -226,27 +801,102 @@ void setup() {
   
   
   led_set_all(0, 0, 0, 1);
+  
+#if BENCHMARK
+  run_benchmarks();
+#endif
+#if RECORD_CUE
+  record_clip(RECORD_CUE, RECORD_SKIP, RECORD_FRAMES);
+#endif
+#if PREVIEW_CUES
+  preview_show();
+#endif
+#if FRAME_REPORT_MS || PROFILE || DC_SERIAL
+  Serial.begin(115200);
+#endif
+#if PROFILE
+  profile_clear();
+#endif
+  
+  // The first frame starts now
+  frame_due_us = micros();
+  frame_start_us = frame_due_us;
 }
 
 // ========= HARDWARE INTERFACE FUNCTIONS ==============================
 
 // Sends grayscale data to the TLCs
+// With SPI this only queues the frame, a chunk at a time; the SPI interrupt
+// shifts each chunk out while the next is packed (and the last while the
+// next frame is being worked out), and reset_counter() latches the frame
+// once every bit is in.
+// If no channel has changed since the last frame (and the last wasn't
+// dithered), nothing is sent at all; the chips keep showing the last
+// latched frame.
 void write_gs_data() {
-  for (loop_var = 0; loop_var < NUM_TLC * 16 * 12; loop_var ++) {	
-	// SCLK low and prepare SIN for data
-	// NB: SCLK_PORT == SIN_PORT
-	SCLK_PORT &= ~(_BV(SCLK) | _BV(SIN));
-	// Send next byte of data
-	// 2048 because it is 100000000000 and so shifts MSB first
-	// 1 would be used if LSB first was required
-	if (PWM_VALUE[grayscale_values[NUM_TLC*16 - loop_var / 12 - 1]] & (2048 >> (loop_var%12))) {
-      SIN_PORT |= _BV(SIN);
+#if NUM_CHAINS == 1
+  unsigned int channels;
+#endif
+  
+#if PWM_DITHER
+  if (!gs_dirty && !gs_dithering) {
+#else
+  if (!gs_dirty) {
+#endif
+    gs_frames_skipped++;
+    return;
+  }
+#if PWM_DITHER
+  // Dithered while it's changing, rounded off once it's not (see
+  // channel_pwm())
+  gs_dithering = gs_dirty;
+#endif
+  gs_dirty = 0;
+  gs_frames_sent++;
+  
+#if USE_SPI
+  // SPI isn't started until BLANK is an output (see init_spi), so anything
+  // sent before that is bit-banged
+  if (SPI_RUNNING()) {
+    // The last channel goes first, so the chunks work back from the end
+    for (unsigned int end = 16*NUM_TLC; end > 0; end -= channels) {
+      channels = min(end, 16*GS_CHUNK_TLC);
+      // Wait for the back buffer to be free, i.e. for the last queued chunk
+      // to have started shifting
+#if PROFILE
+      if (gs_pending) {
+        gs_upload_stalls++;
+      }
+#endif
+      while (gs_pending) IRQ_WAIT();
+      pack_gs_data(gs_data[gs_front ^ 1], end, channels);
+      INTERRUPTS_OFF();
+      gs_pending = end == channels ? GS_LAST : GS_MORE;
+      gs_pending_bytes = channels / 2 * 3;
+      start_gs_upload();
+      INTERRUPTS_ON();
     }
-    // SCLK high - clock bit into input register
-    SCLK_PORT |= _BV(SCLK);
+    return;
   }
-  // Leave SCLK low
-  SCLK_PORT &= ~_BV(SCLK);
+#endif
+
+  // Bit banging overwrites the serial register, so drop any frame still
+  // waiting there rather than have it latched half shifted.
+  INTERRUPTS_OFF();
+#if PROFILE
+  gs_latches_dropped += data_waiting;
+#endif
+  data_waiting = 0;
+  INTERRUPTS_ON();
+#if NUM_CHAINS > 1
+  shift_out_chains();
+#else
+  for (unsigned int end = 16*NUM_TLC; end > 0; end -= channels) {
+    channels = min(end, 16*GS_CHUNK_TLC);
+    pack_gs_data(gs_data[0], end, channels);
+    bitbang_shift_out(gs_data[0], channels / 2 * 3);
+  }
+#endif
     
   // XLAT may only be pulled at the end of a grayscale cycle, so instead,
   // set a variable saying the data is waiting to be latched.  Then
@@ -254,10 +904,218 @@ void write_gs_data() {
   data_waiting = 1; 
 }
 
+// Converts the channels (an even number) of grayscale_values before channel
+// end into 12 bit PWM values and packs them into data.
+// The TLCs want the last channel first and MSB first, so each pair of
+// channels (n, n-1) becomes the three bytes
+// n[11:4], n[3:0]|(n-1)[11:8], (n-1)[7:0]
+void pack_gs_data(byte *data, unsigned int end, unsigned int channels) {
+  unsigned int first;
+  unsigned int second;
+  
+  for (unsigned int channel = end; channel > end - channels; channel -= 2) {
+    first = channel_pwm(channel - 1);
+    second = channel_pwm(channel - 2);
+    *data++ = first >> 4;
+    *data++ = (first << 4) | (second >> 8);
+    *data++ = second;
+  }
+}
+
+// The 12 bit PWM value to send this frame for a channel
+unsigned int channel_pwm(unsigned int channel) {
+#if PWM_DITHER
+  if (gs_dithering) {
+    return dither_channel(channel);
+  }
+  return (pwm_value_fine(grayscale_values[channel], GET_FRACTION(channel))
+    + (1 << (PWM_FRACTION_BITS - 1))) >> PWM_FRACTION_BITS;
+#else
+  return pwm_value(grayscale_values[channel]);
+#endif
+}
+
+#if PWM_DITHER
+// The channel's 12.4 target plus whatever it had left over from its last
+// frame is split into the whole part, which is sent, and the fraction, which
+// is kept for next time.
+unsigned int dither_channel(unsigned int channel) {
+  unsigned int target = pwm_value_fine(grayscale_values[channel], GET_FRACTION(channel));
+  unsigned int sum = target + GET_DITHER_ERROR(channel);
+  
+  SET_DITHER_ERROR(channel, sum & ((1 << PWM_FRACTION_BITS) - 1));
+  return sum >> PWM_FRACTION_BITS;
+}
+
+#if LEAN_RAM
+// Half a byte from an array of them, number n in the bottom half of byte
+// n/2 if n is even, the top half if it's odd
+byte nibble_get(const byte *nibbles, unsigned int n) {
+  return (n & 1 ? nibbles[n >> 1] >> 4 : nibbles[n >> 1]) & 0x0F;
+}
+
+void nibble_set(byte *nibbles, unsigned int n, byte val) {
+  if (n & 1) {
+    nibbles[n >> 1] = (nibbles[n >> 1] & 0x0F) | (val << 4);
+  } else {
+    nibbles[n >> 1] = (nibbles[n >> 1] & 0xF0) | (val & 0x0F);
+  }
+}
+#endif
+
+// The 12.4 PWM value for an 8.8 level, fraction (out of 256) of the way
+// from PWM_VALUE[level] to the next entry.  Level 255 never has a fraction.
+unsigned int pwm_value_fine(byte level, byte fraction) {
+  unsigned int low = pgm_read_word(&PWM_VALUE[level]);
+  
+  if (fraction == 0) {
+    return low;
+  }
+  return low + (((uint32_t)(pgm_read_word(&PWM_VALUE[level + 1]) - low) * fraction) >> 8);
+}
+#endif
+
+// The 12 bit PWM value for an 8 bit level, rounded to the nearest
+unsigned int pwm_value(byte level) {
+  return (pgm_read_word(&PWM_VALUE[level]) + (1 << (PWM_FRACTION_BITS - 1))) >> PWM_FRACTION_BITS;
+}
+
+// Clocks length bytes out of SIN, MSB first, by toggling the pins by hand.
+void bitbang_shift_out(const byte *data, unsigned int length) {
+  byte bit;
+  
+  while (length--) {
+    for (bit = 0x80; bit; bit >>= 1) {
+      // SCLK low and prepare SIN for data
+      SCLK_SIN_LOW();
+      if (*data & bit) {
+        SIN_HIGH();
+      }
+      // SCLK high - clock bit into input register
+      SCLK_HIGH();
+    }
+    data++;
+  }
+  // Leave SCLK low
+  SCLK_LOW();
+}
+
+#if NUM_CHAINS > 1
+// Clocks the channels of every chain out at once, last channel first and
+// MSB first, each chain on its own SIN.
+// For each channel the chains' 12 bit values are turned on their side ('bit
+// sliced') so every clock needs just the one write to CHAIN_SIN_PORT, with
+// bit n for chain n.
+void shift_out_chains() {
+  // Top 8 and bottom 4 bits of each chain's value, chain n in row 7 - n so
+  // it ends up as bit n of the slices.  Rows without a chain stay 0.
+  byte high[8] = {0};
+  byte low[8] = {0};
+  byte slices[16];
+  unsigned int value;
+  
+  for (unsigned int channel = 16*CHAIN_TLC; channel-- > 0; ) {
+    for (byte chain = 0; chain < NUM_CHAINS; chain++) {
+      value = channel_pwm(chain*16*CHAIN_TLC + channel);
+      high[7 - chain] = value >> 4;
+      low[7 - chain] = value << 4;
+    }
+    transpose_bits(high, slices);
+    transpose_bits(low, slices + 8);
+    for (byte bit = 0; bit < 12; bit++) {
+      SCLK_LOW();
+      CHAIN_SIN_WRITE(slices[bit]);
+      // SCLK high - clock the bits into every chain
+      SCLK_HIGH();
+    }
+  }
+  // Leave SCLK low
+  SCLK_LOW();
+}
+
+// Turns an 8x8 block of bits on its side: bit 7 - j of cols[i] is bit 7 - i
+// of rows[j].  Done with masks and shifts on two 32 bit words rather than
+// bit by bit (transpose8 from Hacker's Delight).
+void transpose_bits(const byte *rows, byte *cols) {
+  uint32_t x = ((uint32_t)rows[0] << 24) | ((uint32_t)rows[1] << 16)
+    | ((unsigned int)rows[2] << 8) | rows[3];
+  uint32_t y = ((uint32_t)rows[4] << 24) | ((uint32_t)rows[5] << 16)
+    | ((unsigned int)rows[6] << 8) | rows[7];
+  uint32_t t;
+  
+  // Swap bits across 2x2 blocks, then 2x2 blocks of bits across 4x4 blocks,
+  // then the 4x4 blocks themselves
+  t = (x ^ (x >> 7)) & 0x00AA00AA;
+  x = x ^ t ^ (t << 7);
+  t = (y ^ (y >> 7)) & 0x00AA00AA;
+  y = y ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC;
+  x = x ^ t ^ (t << 14);
+  t = (y ^ (y >> 14)) & 0x0000CCCC;
+  y = y ^ t ^ (t << 14);
+  t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+  y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+  x = t;
+  
+  cols[0] = x >> 24;
+  cols[1] = x >> 16;
+  cols[2] = x >> 8;
+  cols[3] = x;
+  cols[4] = y >> 24;
+  cols[5] = y >> 16;
+  cols[6] = y >> 8;
+  cols[7] = y;
+}
+#endif
+
+#if USE_SPI
+#ifndef TLC_HAL_EXTERNAL
+// Hands SIN and SCLK over to the SPI peripheral.
+// Master, MSB first, SCLK idles low and data is sampled on the rising edge
+// (mode 0), SCLK = f_0/2 = 8MHz.
+// Pin 10 (BLANK) is also the SPI SS pin.  If it is an input and goes low
+// the SPI drops out of master mode, so this must be called after toggle_blank().
+void init_spi() {
+  SPCR = _BV(SPE) | _BV(MSTR);
+  SPSR = _BV(SPI2X);
+}
+#endif
+
+// Starts shifting the pending chunk out of the back buffer if the chips are
+// ready for it: nothing is being shifted and the last frame has been latched.
+// Must be called with interrupts disabled.
+void start_gs_upload() {
+  if (gs_pending && !gs_shifting && !data_waiting) {
+    gs_front ^= 1;
+    gs_shifting = gs_pending;
+    gs_pending = 0;
+    gs_next_byte = gs_data[gs_front];
+    gs_bytes_left = gs_pending_bytes;
+    SPI_IRQ_ON();
+    SPI_WRITE(*gs_next_byte++);
+  }
+}
+
+// Called by the hardware each time the SPI has finished sending a byte
+SPI_ISR() {
+  if (--gs_bytes_left) {
+    SPI_WRITE(*gs_next_byte++);
+  } else {
+    SPI_IRQ_OFF();
+    // Once the whole frame is in the serial register, latch it at the end
+    // of this grayscale cycle.  Until then, carry straight on with the next
+    // chunk if it's ready.
+    data_waiting = gs_shifting == GS_LAST;
+    gs_shifting = 0;
+    start_gs_upload();
+  }
+}
+#endif
+
 // Executed at the end of every grayscale cycle, resets grayscale counter
 void reset_counter() {
   // BLANK HIGH - switch all outputs off and reset the grayscale counter
-  BLANK_PORT |= _BV(BLANK);
+  BLANK_HIGH();
   
   // Disable grayscale clock
   toggle_gsclk();
@@ -265,65 +1123,155 @@ void reset_counter() {
   /*latch new data if waiting*/
   if (data_waiting) {
 	// XLAT high
-	XLAT_PORT |= _BV(XLAT);
+	XLAT_HIGH();
 	// Data no longer waiting
 	data_waiting = 0;
 	// XLAT low
-	XLAT_PORT &= ~_BV(XLAT);
+	XLAT_LOW();
+#if PROFILE
+	gs_latches++;
+#endif
   }
+#if USE_SPI
+  // The serial register is free again, so start on the next frame
+  start_gs_upload();
+#endif
   
   // Enable grayscale clock again
   toggle_gsclk();
   
   // BLANK low - enable outputs and begin new grayscale cycle
-  BLANK_PORT &= ~_BV(BLANK);
+  BLANK_LOW();
 }
 
 // Switches the grayscale clock on or off by disabling/enabling pin 3 as an output
 void toggle_gsclk() {
-  DDRD ^= _BV(GSCLK);
+  GSCLK_TOGGLE();
 }
 
 // Switches the blank signal on or off by disabling/enabling pin 10 as an output
 void toggle_blank() {
-  DDRB ^= _BV(BLANK);
+  BLANK_TOGGLE();
 }
 
 // Set a specific channel with a brightness given by val.
 // val is an 8 bit integer (0 - 255) and is converted into a 12 bit one
 // before being sent to the TLC
-void channel_set(byte channel, byte val) {
-  grayscale_values[channel] = val;
+void channel_set(unsigned int channel, byte val) {
+  channel_set_fine(channel, (unsigned int)val << 8);
+}
+
+// Same as channel_set, but val is 8.8 fixed point (0 - 255.0).
+// The fraction is only kept with PWM_DITHER (and only to 4 bits with
+// LEAN_RAM); otherwise it is dropped.
+void channel_set_fine(unsigned int channel, unsigned int val) {
+  gs_dirty |= grayscale_values[channel] ^ (byte)(val >> 8);
+  grayscale_values[channel] = val >> 8;
+#if PWM_DITHER
+  val &= FRACTION_MASK;
+  gs_dirty |= GET_FRACTION(channel) ^ (byte)val;
+  SET_FRACTION(channel, val);
+#endif
 }
 
 // Set all channels to the same brightness given by val
 void channel_set_all(byte val) {
-  if (val < 4096) {
-	for (loop_var = 0; loop_var < 16 * NUM_TLC; loop_var++) {
-	  channel_set(loop_var, val);
-	}
+  for (unsigned int channel = 0; channel < NUM_CHANNELS; channel++) {
+	channel_set(channel, val);
   }
 }
 
 // ========= PROGRAMMING FUNCTIONS =====================================
 
-// fade_speeds holds the speed at which grayscale values approaches new grayscale values.
-// a fade speed of 0 indicates no fade, just an instant switch.
-byte fade_speeds[NUM_LED];
 // new_grayscale_values holds the values the current grayscale values are fading towards
-byte new_grayscale_values[16*NUM_TLC];
-byte index = 0;
-byte fade_counter = 0;
+byte new_grayscale_values[NUM_CHANNELS];
+
+// Fade state for each LED, one array per field so perform_fades() can run
+// straight through them.
+// The three channels of an LED are packed into the low three bytes ('lanes')
+// of a 32 bit word, channel LED_CHANNEL(led, n) in lane n, so they can all be worked
+// on at once (see fade_lanes()):
+// fade_from - the channel values when the fade started
+// fade_up - how far each channel has to rise (0 if it's falling)
+// fade_down - how far each channel has to fall (0 if it's rising)
+// With LEAN_RAM only fade_from is kept, and fade_distances() works the
+// other two out from new_grayscale_values each time.
+uint32_t fade_from[NUM_LED];
+#if !LEAN_RAM
+uint32_t fade_up[NUM_LED];
+uint32_t fade_down[NUM_LED];
+#endif
+// When the fade started (frame_ms), how many milliseconds it
+// lasts, and how far through it gets per millisecond in 16.16 fixed point,
+// where 256 is the end.  All three channels share these, so they arrive
+// at the same time.  LEAN_RAM does without fade_time (see fade_led()).
+unsigned int fade_start[NUM_LED];
+#if !LEAN_RAM
+unsigned int fade_time[NUM_LED];
+#endif
+unsigned long fade_rate[NUM_LED];
+
+// The time of the current frame (low 16 bits of millis()).  Set once a frame
+// by loop(), and used by everything that runs on the clock in that frame,
+// so it all moves together (and can be run on a made up clock, see RECORD_CUE).
+unsigned int frame_ms = 0;
+
+// One bit per LED, set from the moment it is given a new colour until it gets
+// there.  perform_fades() only visits LEDs with their bit set, so the time it
+// takes goes with how many LEDs are changing rather than how many there are.
+byte fading[(NUM_LED + 7) / 8];
+// How many bits are set in fading
+unsigned int leds_fading = 0;
+
+#if LAYERS
+#define NO_LAYER		0xFF
+// The colour each effect instance's layer has for each LED (red, green, blue
+// of LED 0, then LED 1...), and the fade each LED was last given by any of
+// them (see Layers)
+byte layer_rgb[NUM_EFFECTS][3*NUM_LED];
+byte layer_fade[NUM_LED];
+// One bit per LED, set when any of its layers change so it gets blended again
+byte layer_dirty[(NUM_LED + 7) / 8];
+// The layer that led_set_new() draws into, or NO_LAYER for the frame itself
+byte drawing_layer = NO_LAYER;
+#endif
+
+// The RAM that goes up with the length of the chain: everything kept for
+// each channel and each LED.  The benchmarks print it per chip.
+const unsigned int CHAIN_RAM = sizeof(grayscale_values) + sizeof(new_grayscale_values)
+  + sizeof(gs_data) + sizeof(fade_from) + sizeof(fade_start) + sizeof(fade_rate)
+  + sizeof(fading)
+#if PWM_DITHER
+  + sizeof(grayscale_fraction) + sizeof(dither_error)
+#endif
+#if !LEAN_RAM
+  + sizeof(fade_up) + sizeof(fade_down) + sizeof(fade_time)
+#endif
+#if LAYERS
+  + sizeof(layer_rgb) + sizeof(layer_fade) + sizeof(layer_dirty)
+#endif
+#if FIXTURE_MAP
+  + sizeof(channel_lanes)
+#endif
+  ;
+
+#ifndef TLC_HAL_EXTERNAL
+// Stop the build, rather than the board at run time, if that doesn't leave
+// at least 512 bytes for everything else (the stack, serial buffers etc.)
+static_assert(CHAIN_RAM <= RAMEND - RAMSTART + 1 - 512,
+  "Not enough RAM for NUM_TLC and NUM_LED; see How many chips in README.md");
+#endif
 
 // The cue number - changed only when a cue advance command is received
 int cue = 0;
 // These two variables can be used to advance the cue number automatically
 // after a preset amount of time.
 byte sub_cue = 0;
-long auto_advance_counter = 0;
+unsigned long auto_advance_counter = 0;
 
 /*
- * This array takes some explaining.
+ * The colours array takes some explaining.  Each effect instance has one
+ * of its own (see Effect Instances).
  * At all times, there are 4 colours defined:
  * Background (BG), Foreground1 (FG1), Foreground2 (FG2) and ForegroundCurrent (FGC).
  * These are used by the effect functions in various ways, but the background colour
@@ -338,21 +1286,24 @@ long auto_advance_counter = 0;
  * See assign_colours function for specifics.
  * 
  * You can also set the number of increments; i.e. how many different shades
- * there are between the 2 foreground colours.
+ * there are between the 2 foreground colours.  Together they make a palette
+ * of NUM_INC + 1 colours, from FG1 (0) to FG2 (NUM_INC), and FGC is always
+ * one of them.  Rather than keeping the palette, PAL_STEP (3 bytes, LSB
+ * first) says how far apart its colours are, so any of them can be worked
+ * out straight away (see palette_colour()).
  * 
- * DIR is used if the fade style is smooth (as opposed to random).
- * If DIR is 1 then the colour is changing from FG1 to FG2, and vice
- * versa if DIR is -1.
+ * PAL_INDEX and DIR are used if the fade style is smooth (as opposed to
+ * random).  PAL_INDEX is where FGC is in the palette; if DIR is 0 it is
+ * going from FG1 to FG2, and back again if DIR is 1.
  * 
  * The constants just refer locations in the colours array and should not
  * be changed.  They are used for readability.
  * 
- * There is an RGB for each colour and an increment for each of RGB as well.
+ * There is an RGB for each colour.
  * 
  * The overall point of this array is facilitate effects being of more than
  * one colour; instead they can be any colour along a spectrum.
  */
-byte colours[18];
 
 #define BG_RED			0
 #define BG_GREEN		1
@@ -368,785 +1319,1584 @@ byte colours[18];
 #define	FGC_BLUE		11
 #define FADE_STYLE		12
 #define NUM_INC			13
-#define INC_RED			14
-#define INC_GREEN		15
-#define INC_BLUE		16
+#define PAL_STEP		14
 #define DIR				17
+#define PAL_INDEX		18
+#define COLOURS_SIZE	19
 
-unsigned int anim_count = 0;
-byte off_speed = 0;
+// Stops every LED where it is, e.g. for something else to take over the channels
+void stop_fades() {
+  for (unsigned int group = 0; group < sizeof(fading); group++) {
+    fading[group] = 0;
+  }
+  leds_fading = 0;
+}
 
 // Sets the led colour directly, no fading
-void led_set(byte led, byte R, byte G, byte B) {
-  channel_set(3*led + RED_L, R);
-  channel_set(3*led + GREEN_L, G);
-  channel_set(3*led + BLUE_L, B);
+void led_set(unsigned int led, byte R, byte G, byte B) {
+  FIXTURE_COLOUR(led, R, G, B);
+  channel_set(LED_CHANNEL(led, RED_L), R);
+  channel_set(LED_CHANNEL(led, GREEN_L), G);
+  channel_set(LED_CHANNEL(led, BLUE_L), B);
+}
+
+// Sets the new state for an led so it fades there.
+// fade is the old style fade speed: how much each channel moves per step
+// of FADE_STEP_MS.  A fade of 0 means switch instantly.
+void led_set_new(unsigned int led, byte R, byte G, byte B, byte fade) {
+  unsigned int steps = 0;
+  
+#if LAYERS
+  if (drawing_layer != NO_LAYER) {
+    layer_set(drawing_layer, led, R, G, B, fade);
+    return;
+  }
+#endif
+  FIXTURE_COLOUR(led, R, G, B);
+  if (fade != 0) {
+    // Still on its way there: carry on at the speed it was given, rather
+    // than start again over what's left
+    if (get_new_led_red(led) == R && get_new_led_green(led) == G
+      && get_new_led_blue(led) == B) {
+      return;
+    }
+    // The channel with furthest to go sets how many steps the fade takes
+    int furthest = abs(R - get_led_red(led));
+    furthest = max(furthest, abs(G - get_led_green(led)));
+    furthest = max(furthest, abs(B - get_led_blue(led)));
+    steps = (furthest + fade - 1) / fade;
+  }
+  led_fade_to(led, R, G, B, steps * FADE_STEP_MS);
+}
+
+// Fades an led from its current colour to R, G, B over time milliseconds.
+// If it is already that colour, or fading to it over the same time, the
+// fade carries on as it was.  Otherwise it starts again from wherever it's
+// got to, so a time of 0 always switches straight there.
+void led_fade_to(unsigned int led, byte R, byte G, byte B, unsigned int time) {
+  uint32_t from = 0;
+  uint32_t up;
+  uint32_t down;
+  unsigned long rate = 0;
+  
+#if LEAN_RAM
+  // Rounded up so it gets to 256 by the time it should, and kept below
+  // 2^24 so fade_led() can't overflow
+  if (time != 0) {
+    rate = min((256UL << 16) / time + 1, 0xFFFFFFUL);
+  }
+#else
+  if (time != 0) {
+    rate = (256UL << 16) / time;
+  }
+#endif
+  FIXTURE_COLOUR(led, R, G, B);
+  if (get_new_led_red(led) == R && get_new_led_green(led) == G
+    && get_new_led_blue(led) == B
+    && (!(fading[led >> 3] & _BV(led & 7)) || fade_rate[led] == rate)) {
+    return;
+  }
+  new_grayscale_values[LED_CHANNEL(led, RED_L)] = R;
+  new_grayscale_values[LED_CHANNEL(led, GREEN_L)] = G;
+  new_grayscale_values[LED_CHANNEL(led, BLUE_L)] = B;
+  
+  for (byte lane = 0; lane < 3; lane++) {
+    from |= (uint32_t)grayscale_values[LED_CHANNEL(led, lane)] << 8*lane;
+  }
+  fade_distances(led, from, &up, &down);
+  
+  fade_from[led] = from;
+  fade_start[led] = frame_ms;
+  fade_rate[led] = rate;
+#if !LEAN_RAM
+  fade_up[led] = up;
+  fade_down[led] = down;
+  fade_time[led] = time;
+#endif
+  // Nothing to do if it's already that colour
+  set_fading(led, up | down);
+}
+
+// How far each lane of an LED has to go up and down to get from from to its
+// new_grayscale_values
+void fade_distances(unsigned int led, uint32_t from, uint32_t *up, uint32_t *down) {
+  byte now;
+  byte to;
+  
+  *up = 0;
+  *down = 0;
+  for (byte lane = 0; lane < 3; lane++) {
+    now = from >> 8*lane;
+    to = new_grayscale_values[LED_CHANNEL(led, lane)];
+    if (to > now) {
+      *up |= (uint32_t)(to - now) << 8*lane;
+    } else {
+      *down |= (uint32_t)(now - to) << 8*lane;
+    }
+  }
 }
 
-// Sets the new state for an led so it
-void led_set_new(byte led, byte R, byte G, byte B, byte fade) {
-  new_grayscale_values[3*led + RED_L] = R;
-  new_grayscale_values[3*led + GREEN_L] = G;
-  new_grayscale_values[3*led + BLUE_L] = B;
-  fade_speeds[led] = fade;
+// Sets (if on is non-zero) or clears the LED's bit in fading
+void set_fading(unsigned int led, uint32_t on) {
+  byte mask = _BV(led & 7);
+  byte *group = &fading[led >> 3];
+  
+  if (on && !(*group & mask)) {
+    *group |= mask;
+    leds_fading++;
+  } else if (!on && (*group & mask)) {
+    *group &= ~mask;
+    leds_fading--;
+  }
 }
 
 void led_set_all(byte R_A, byte G_A, byte B_A, byte fade_a) {
-  for (index = 0; index < NUM_LED; index++) {
-	led_set_new(index, R_A, G_A, B_A, fade_a);
+  for (unsigned int led = 0; led < NUM_LED; led++) {
+	led_set_new(led, R_A, G_A, B_A, fade_a);
   }
 }
 
 // Collection of functions for getting the current and,
 // if applicable, the future state of LEDs.
-byte get_led_red(byte led) {
-  return grayscale_values[3*led + RED_L];
+byte get_led_red(unsigned int led) {
+  return grayscale_values[LED_CHANNEL(led, RED_L)];
 }
 
-byte get_led_blue(byte led) {
-  return grayscale_values[3*led + BLUE_L];
+byte get_led_blue(unsigned int led) {
+  return grayscale_values[LED_CHANNEL(led, BLUE_L)];
 }
 
-byte get_led_green(byte led) {
-  return grayscale_values[3*led + GREEN_L];
+byte get_led_green(unsigned int led) {
+  return grayscale_values[LED_CHANNEL(led, GREEN_L)];
 }
 
-byte get_new_led_red(byte led) {
-  return new_grayscale_values[3*led + RED_L];
+byte get_new_led_red(unsigned int led) {
+  return new_grayscale_values[LED_CHANNEL(led, RED_L)];
 }
 
-byte get_new_led_blue(byte led) {
-  return new_grayscale_values[3*led + BLUE_L];
+byte get_new_led_blue(unsigned int led) {
+  return new_grayscale_values[LED_CHANNEL(led, BLUE_L)];
 }
 
-byte get_new_led_green(byte led) {
-  return new_grayscale_values[3*led + GREEN_L];
+byte get_new_led_green(unsigned int led) {
+  return new_grayscale_values[LED_CHANNEL(led, GREEN_L)];
 }
 
-// Possibly the messiest function I've ever written.
-// This loops through all LEDs.  If the grayscale value is not equal
-// to the new grayscale value, then the grayscale value will be changed
-// by a maximum of the fade value.  If the difference between the
-// grayscale value and the new grayscale value is less than the fade
-// value, then the grayscale value is set equal to the new grayscale value.
-// Special case:  If the fade value == 0, then the grayscale value is
-// set immediately to the new grayscale value.
+// Moves every LED along its fade.
+// progress runs from 0 at the start of the fade to 256 at the end, and each
+// channel is at from + up*progress/256 - down*progress/256, worked out in 8.8
+// fixed point so the fraction can be dithered.  At 256 that is exactly the
+// new grayscale value.
+// The sums are done on all the lanes of an LED at once (see fade_lanes()).
+// A lane only ever rises as far as its new value (at most 255.0) or falls
+// as far as its new value (at least 0), and if it's been given more than
+// that it stops at 255.996 or 0 rather than wrapping round.
+// Once an LED gets there it drops out of fading and is left alone until
+// it's given a new colour.
 void perform_fades() {
+  unsigned int now = frame_ms;
   
-  byte new_red = 0;
-  byte new_green = 0;
-  byte new_blue = 0;
+  for (unsigned int group = 0; group < sizeof(fading); group++) {
+    // Skip 8 LEDs at a time while nothing is moving
+    if (fading[group] == 0) {
+      continue;
+    }
+    for (byte bit = 0; bit < 8; bit++) {
+      if (fading[group] & _BV(bit)) {
+        fade_led(8*group + bit, now);
+      }
+    }
+  }
+}
+
+// Moves one LED along its fade, now being frame_ms
+void fade_led(unsigned int led, unsigned int now) {
+  unsigned int elapsed = now - fade_start[led];
+  unsigned int progress = 256;
+  uint32_t from = fade_from[led];
+  uint32_t up;
+  uint32_t down;
+  uint64_t lanes;
   
-  for (index = 0; index < NUM_LED; index++) {
-	  
-	new_red = grayscale_values[3*index + RED_L];
-	new_green = grayscale_values[3*index + GREEN_L];
-	new_blue = grayscale_values[3*index + BLUE_L];
-	
-	if (fade_speeds[index] == 0) {
-		
-	  new_red = new_grayscale_values[3*index + RED_L];
-	  new_green = new_grayscale_values[3*index + GREEN_L];
-	  new_blue = new_grayscale_values[3*index + BLUE_L];
-	  
-	} else if (grayscale_values[3*index + RED_L] != new_grayscale_values[3*index + RED_L]
-	          || grayscale_values[3*index + GREEN_L] != new_grayscale_values[3*index + GREEN_L]
-	          || grayscale_values[3*index + BLUE_L] != new_grayscale_values[3*index + BLUE_L]) {
-	  
-	  if (grayscale_values[3*index + RED_L] < new_grayscale_values[3*index + RED_L]) {
-		if (new_grayscale_values[3*index + RED_L] - grayscale_values[3*index + RED_L] < fade_speeds[index]) {
-		  new_red = new_grayscale_values[3*index + RED_L]; 
-		} else {
-		  new_red = grayscale_values[3*index + RED_L] + fade_speeds[index];
-		}
-	  } else if (grayscale_values[3*index + RED_L] > new_grayscale_values[3 * index + RED_L]) {
-		if (grayscale_values[3*index + RED_L] - new_grayscale_values[3*index + RED_L] < fade_speeds[index]) {
-		  new_red = new_grayscale_values[3*index + RED_L];
-		} else {
-		  new_red = grayscale_values[3*index + RED_L] - fade_speeds[index];
-		}
-	  }
-	  
-	  if (grayscale_values[3*index + GREEN_L] < new_grayscale_values[3*index + GREEN_L]) {
-		if (new_grayscale_values[3*index + GREEN_L] - grayscale_values[3*index + GREEN_L] < fade_speeds[index]) {
-		  new_green = new_grayscale_values[3*index + GREEN_L]; 
-		} else {
-		  new_green = grayscale_values[3*index + GREEN_L] + fade_speeds[index];
-		}
-	  } else if (grayscale_values[3*index + GREEN_L] > new_grayscale_values[3 * index + GREEN_L]) {
-		if (grayscale_values[3*index + GREEN_L] - new_grayscale_values[3*index + GREEN_L] < fade_speeds[index]) {
-		  new_green = new_grayscale_values[3*index + GREEN_L];
-		} else {
-		  new_green = grayscale_values[3*index + GREEN_L] - fade_speeds[index];
-		}
-	  }
-	  
-	  if (grayscale_values[3*index + BLUE_L] < new_grayscale_values[3*index + BLUE_L]) {
-		if (new_grayscale_values[3*index + BLUE_L] - grayscale_values[3*index + BLUE_L] < fade_speeds[index]) {
-		  new_blue = new_grayscale_values[3*index + BLUE_L]; 
-		} else {
-		  new_blue = grayscale_values[3*index + BLUE_L] + fade_speeds[index];
-		}
-	  } else if (grayscale_values[3*index + BLUE_L] > new_grayscale_values[3 * index + BLUE_L]) {
-		if (grayscale_values[3*index + BLUE_L] - new_grayscale_values[3*index + BLUE_L] < fade_speeds[index]) {
-		  new_blue = new_grayscale_values[3*index + BLUE_L];
-		} else {
-		  new_blue = grayscale_values[3*index + BLUE_L] - fade_speeds[index];
-		}
-	  }
-	}
-	
-	led_set(index, new_red, new_green, new_blue);	
+#if LEAN_RAM
+  // Without fade_time, it's done once progress gets to 256.  The top of
+  // elapsed is checked first: if that alone doesn't get there, the whole
+  // multiply can't overflow.
+  fade_distances(led, from, &up, &down);
+  if (fade_rate[led] != 0 && (elapsed >> 8) * fade_rate[led] < 0x10000) {
+    progress = min((elapsed * fade_rate[led]) >> 16, 256);
+  }
+#else
+  up = fade_up[led];
+  down = fade_down[led];
+  if (elapsed < fade_time[led]) {
+    progress = (elapsed * fade_rate[led]) >> 16;
+  }
+#endif
+  
+  // Lane n in bits 16n to 16n + 15
+  lanes = fade_lanes(from, up, down, progress);
+  
+  if (progress == 256) {
+    fade_from[led] = ((uint32_t)(lanes >> 8) & 0xFF) | ((uint32_t)(lanes >> 16) & 0xFF00)
+      | ((uint32_t)(lanes >> 24) & 0xFF0000);
+#if !LEAN_RAM
+    fade_up[led] = 0;
+    fade_down[led] = 0;
+#endif
+    set_fading(led, 0);
+  }
+  channel_set_fine(LED_CHANNEL(led, 0), lanes);
+  channel_set_fine(LED_CHANNEL(led, 1), lanes >> 16);
+  channel_set_fine(LED_CHANNEL(led, 2), lanes >> 32);
+}
+
+// The top bit of each 16 bit lane of a 64 bit word
+#define LANES_TOP		0x8000800080008000ULL
+
+#if FADE_ON_SSE2
+// Works out from*256 + up*progress - down*progress (progress is 0 - 256)
+// for each of the four 8 bit lanes of the words at once, in 16 bit lanes
+// of the result (lane n in bits 16n to 16n + 15).  The sum stops at 0xFFFF
+// and the difference at 0, each lane on its own.  SSE2 has those as
+// instructions.
+uint64_t fade_lanes(uint32_t from, uint32_t up, uint32_t down, unsigned int progress) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i by = _mm_set1_epi16(progress);
+  __m128i level = _mm_slli_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(from), zero), 8);
+  __m128i rise = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(up), zero), by);
+  __m128i fall = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(down), zero), by);
+  uint64_t lanes;
+  
+  _mm_storel_epi64((__m128i *)&lanes, _mm_subs_epu16(_mm_adds_epu16(level, rise), fall));
+  return lanes;
+}
+#elif FADE_SWAR
+// The same in a 64 bit word: each 8 bit lane spread out to 16 bits, so
+// nothing spills into the next lane (at most 255*256), and the sum and
+// difference worked out on the bottom 15 bits of every lane with the top
+// bits put back in after, so a carry or borrow out of a lane can be seen
+// and saturated rather than passed on.
+uint64_t fade_lanes(uint32_t from, uint32_t up, uint32_t down, unsigned int progress) {
+  uint64_t level = spread_lanes(from) << 8;
+  uint64_t rise = lanes_times(spread_lanes(up), progress);
+  uint64_t fall = lanes_times(spread_lanes(down), progress);
+  uint64_t sum = ((level & ~LANES_TOP) + (rise & ~LANES_TOP)) ^ ((level ^ rise) & LANES_TOP);
+  uint64_t carry = ((level & rise) | ((level | rise) & ~sum)) & LANES_TOP;
+  uint64_t difference;
+  uint64_t borrow;
+  
+  // Carried lanes go to 0xFFFF
+  sum |= (carry >> 15) * 0xFFFF;
+  difference = ((sum | LANES_TOP) - (fall & ~LANES_TOP)) ^ ((sum ^ ~fall) & LANES_TOP);
+  borrow = ((~sum & fall) | (~(sum ^ fall) & difference)) & LANES_TOP;
+  // and borrowed ones to 0
+  return difference & ~((borrow >> 15) * 0xFFFF);
+}
+
+// The four bytes of a word, one to each 16 bit lane
+uint64_t spread_lanes(uint32_t bytes) {
+  uint64_t lanes = bytes;
+  
+  lanes = (lanes | lanes << 16) & 0x0000FFFF0000FFFFULL;
+  return (lanes | lanes << 8) & 0x00FF00FF00FF00FFULL;
+}
+
+// Each lane times progress (up to 256, so a lane at most 0xFF00), as two
+// 32 bit multiplies since the AVR has no 64 bit one
+uint64_t lanes_times(uint64_t lanes, unsigned int progress) {
+  return (uint64_t)((uint32_t)(lanes >> 32) * progress) << 32 | (uint32_t)lanes * progress;
+}
+#else
+// One lane at a time version of the above
+uint64_t fade_lanes(uint32_t from, uint32_t up, uint32_t down, unsigned int progress) {
+  uint64_t lanes = 0;
+  
+  for (byte lane = 0; lane < 4; lane++) {
+    uint32_t level = (((from >> 8*lane) & 0xFF) << 8) + ((up >> 8*lane) & 0xFF) * progress;
+    uint32_t fall = ((down >> 8*lane) & 0xFF) * progress;
+    
+    if (level > 0xFFFF) {
+      level = 0xFFFF;
+    }
+    lanes |= (uint64_t)(level > fall ? level - fall : 0) << 16*lane;
   }
-  fade_counter++;
+  return lanes;
 }
+#endif
 
 void loop() {
 
   //  Advance cue number if signal is recieved on pin 5
   //  Go back a cue if a signal is recieved on pin 7
   //  The HDSHK pin is pulsed to tell the other arduino that the signal has been recieved.
-  if (RCV_ADV_IN & _BV(RCV_ADV)) {
-    HDSHK_PORT |= _BV(HDSHK);
+  if (ADVANCE_RECEIVED()) {
+    HDSHK_HIGH();
     cue++;
     auto_advance_counter = 0;
-    anim_count = 0;
+    restart_effects();
     sub_cue = 0;
   }
-  if (RCV_BAK_IN & _BV(RCV_BAK)) {
-    HDSHK_PORT |= _BV(HDSHK);
+  if (BACK_RECEIVED()) {
+    HDSHK_HIGH();
     if (cue > 0) {
 	  cue--;
 	  auto_advance_counter = 0;
-	  anim_count = 0;
+	  restart_effects();
           sub_cue = 0;
 	}
   }
   
+  frame_ms = millis();
   animate();
+  PROFILE_STAGE(PROFILE_ANIMATE);
   perform_fades();
+  PROFILE_STAGE(PROFILE_FADES);
   write_gs_data();
-  delayMicroseconds(200);
+  PROFILE_STAGE(PROFILE_UPLOAD);
   
-  HDSHK_PORT &= ~_BV(HDSHK);
+  // Also keeps the handshake pulse going until the next frame
+  wait_for_frame();
+  HDSHK_LOW();
 }
 
-// This function is where the animation functions are called from
-// I've left my animations as examples of how you might programme a list
-// of cues.
-void animate() {
+// Waits until the next frame is due.
+// Frames are due every FRAME_MS from the first one, not FRAME_MS after the
+// last one finished, so the time each frame takes doesn't add up into drift.
+// A frame that runs over leaves the next one less time; one that runs over
+// by whole frames drops those frames rather than trying to catch them up.
+void wait_for_frame() {
+  unsigned long now = micros();
+  unsigned long late;
+  
+  if (now - frame_start_us > frame_worst_us) {
+    frame_worst_us = now - frame_start_us;
+  }
+  frames_run++;
+#if PROFILE
+  profile_frame(now - frame_start_us);
+#endif
+  
+  frame_due_us += FRAME_US;
+  if ((long)(now - frame_due_us) >= 0) {
+    frame_overruns++;
+    late = (now - frame_due_us) / FRAME_US;
+    frames_dropped += late;
+    frame_due_us += late * FRAME_US;
+    frames_behind = late < CATCH_UP_FRAMES ? late : CATCH_UP_FRAMES;
+  } else {
+    while ((long)(micros() - frame_due_us) < 0);
+  }
+#if FRAME_REPORT_MS
+  report_frames();
+#endif
+#if PROFILE || DC_SERIAL
+  serial_poll();
+#endif
+  frame_start_us = micros();
+}
 
-  if (cue == 1) {
-        
-    if (auto_advance_counter == 250 || auto_advance_counter == 500 || auto_advance_counter == 750) {
-      anim_count = 0;
-      sub_cue++;
-    }
-    
-	if (sub_cue == 0) {
-      assign_colours(BLACK, RED, RED, 0, 1);
-      all_on(0, 0);
-	} else if (sub_cue == 1) {
-	  assign_colours(BLACK, GREEN, GREEN, 0, 1);
-	  all_on(0, 0);
-	} else if (sub_cue == 2) {
-	  assign_colours(BLACK, BLUE, BLUE, 0, 0);
-	  all_on(0, 0);
-	} else {
-          sub_cue = 0;
-	  auto_advance_counter = 0;
-	}
-	
-  } else if (cue == 2) {
-	all_off();
-	
-  } else if (cue == 3) {
-	// Whenever one of these conditions is true, the subcue number automatically
-	// advances.  Auto_advance_counter is incremented in the animation functions
-	// at various rates which depend on the effect.
-    if (auto_advance_counter == 2000 || auto_advance_counter == 3000 
-    || auto_advance_counter == 4000 || auto_advance_counter == 5000) {
-          
-      anim_count = 0;
-      sub_cue++;
-    }
-    
-	if (sub_cue == 0) {
-	  // For each sub cue, first, colours are assigned
-	  // The background colour, the two foreground colours, the fade_style
-	  // and then the number of shades in between the two colours that are
-	  // available
- 	  assign_colours(BLACK, BLUE, WHITE, 1, 255);
- 	  // Call the effect
-	  raindrops(1, 1, 15, 5, 0);
-	} else if (sub_cue == 1) {
-	  assign_colours(BLACK, BLUE, WHITE, 4, 255);
-	  pattern_shift(448, 9, 0, 0, 1, 1);
-	} else if (sub_cue == 2) {
-	  assign_colours(BLACK, BLUE, WHITE, 3, 255);
-	  pattern_invert(341, 30, 0, 0);
-	} else if (sub_cue == 3) {
-	  assign_colours(BLACK, BLUE, WHITE, 3, 255);
-	  runners(7, 1, 25, 8, 0, 0);
-	} else {
-	  sub_cue = 1;
-	  auto_advance_counter = 2001;
-	}
-	
-  } else if (cue == 4) {
-	all_off();
-	
-  } else if (cue == 5) {
-	if (auto_advance_counter == 1560 || auto_advance_counter == 1660 
-        || auto_advance_counter ==  2300 || auto_advance_counter == 2400
-        || auto_advance_counter == 2500 || auto_advance_counter == 2600
-        || auto_advance_counter == 3100 || auto_advance_counter == 4620) {
-          
-          anim_count = 0;
-          sub_cue++;
-        }
-    
-	if (sub_cue == 0) {
-	  assign_colours(0, 50, 0, 0, 0, 50, GREEN, 0, 255);
-      fades(29, 3, 3);
-	} else if (sub_cue == 1) {
-	  assign_colours(BLUE, BLUE, GREEN, 0, 255);
-      all_on(3, 3);
-	} else if (sub_cue == 2) {
-	  assign_colours(0, 50, 0, 0, 0, 50, GREEN, 0, 255);
-      fades(29, 3, 3);
-	} else if (sub_cue == 3) {
-	  assign_colours(BLUE, GREEN, GREEN, 0, 255);
-      all_on(3, 3);
-	} else if (sub_cue == 4) {
-	  assign_colours(0, 50, 0, 0, 0, 50, GREEN, 0, 255);
-      fades(29, 3, 3);
-	} else if (sub_cue == 5) {
-	  assign_colours(BLUE, BLUE, GREEN, 0, 255);
-      all_on(3, 3);
-	} else if (sub_cue == 6) {
-	  assign_colours(0, 50, 0, 0, 0, 50, GREEN, 0, 255);
-      fades(29, 3, 3);
-	} else if (sub_cue == 7) {
-	  assign_colours(BLACK, BLUE, GREEN, 1, 255);
-      fades(32, 0, 0);
-	} else if (sub_cue == 8) {
-	  assign_colours(BLACK, BLUE, GREEN, 2, 255);
-      runners(3, 1, 0, 30, 0, 1);
-	} else {
-      sub_cue = 0;
-	  auto_advance_counter = 0;
-	}
-	
-  } else if (cue == 6) {
-    all_off();
-    
-  } else if (cue == 7) {
-	assign_colours(BLACK, BLUE, PINK, 1, 255);
-	raindrops(15, 2, 5, 5, 1);
-	
-  } else if (cue == 8) {
-	all_off();
-	
-  } else if (cue == 9) {
-	if (auto_advance_counter == 220 || auto_advance_counter == 240 
-        || auto_advance_counter ==  430 || auto_advance_counter == 450
-        || auto_advance_counter == 470 || auto_advance_counter == 490
-        || auto_advance_counter == 650 || auto_advance_counter == 670
-        || auto_advance_counter ==  860 || auto_advance_counter == 880
-        || auto_advance_counter == 900 || auto_advance_counter == 920
-        || auto_advance_counter == 1080 || auto_advance_counter == 1100
-        || auto_advance_counter ==  1290 || auto_advance_counter == 1310
-        || auto_advance_counter == 1330 || auto_advance_counter == 1350
-        || auto_advance_counter == 1510 || auto_advance_counter == 1530
-        || auto_advance_counter ==  1720 || auto_advance_counter == 1740
-        || auto_advance_counter == 1760 || auto_advance_counter == 1780
-        || auto_advance_counter == 1940) {
-          
-          anim_count = 0;
-          sub_cue++;
-        }
-        
-        assign_colours(BLACK, RED, PINK, 1, 255);
-    
-	if (sub_cue == 0) {
-      all_off();
-      auto_advance_counter++;
-	} else if (sub_cue == 1) {
-      all_on(0, 5);
-	} else if (sub_cue == 2) {
-      fades(45, 7, 7);
-	} else if (sub_cue == 3) {
-      all_on(0, 0);
-	} else if (sub_cue == 4) {
-      all_off();
-      auto_advance_counter++;
-	} else if (sub_cue == 5) {
-      all_on(0, 2); 
-    } else if (sub_cue == 6) {
-      all_off();
-      auto_advance_counter++;
-          
-	} else if (sub_cue == 7) {
-      all_on(0, 5);
-	} else if (sub_cue == 8) {
-      fades(45, 7, 7);
-	} else if (sub_cue == 9) {
-      all_on(0, 0);
-	} else if (sub_cue == 10) {
-      all_off();
-      auto_advance_counter++;
-	} else if (sub_cue == 11) {
-      all_on(0, 2); 
-    } else if (sub_cue == 12) {
-      all_off();
-      auto_advance_counter++;
-      
-	} else if (sub_cue == 13) {
-      all_on(0, 5);
-	} else if (sub_cue == 14) {
-      fades(45, 7, 7);
-	} else if (sub_cue == 15) {
-      all_on(0, 0);
-	} else if (sub_cue == 16) {
-      all_off();
-      auto_advance_counter++;
-	} else if (sub_cue == 17) {
-      all_on(0, 2); 
-    } else if (sub_cue == 18) {
-      all_off();
-      auto_advance_counter++;
-    
-    } else if (sub_cue == 19) {
-      all_on(0, 5);
-	} else if (sub_cue == 20) {
-      fades(45, 7, 7);
-	} else if (sub_cue == 21) {
-      all_on(0, 0);
-	} else if (sub_cue == 22) {
-      all_off();
-      auto_advance_counter++;
-	} else if (sub_cue == 23) {
-      all_on(0, 2); 
-    } else if (sub_cue == 24) {
-      all_off();
-      auto_advance_counter++;
-          
-	} else {
-          raindrops(1, 1, 20, 20, 0);
-	}
+#if FRAME_REPORT_MS
+// Prints frames,<run>,<overruns>,<dropped>,<worst us> every FRAME_REPORT_MS
+void report_frames() {
+  static unsigned long last_ms = 0;
+  
+  if (millis() - last_ms >= FRAME_REPORT_MS) {
+    last_ms = millis();
+    Serial.print(F("frames,"));
+    Serial.print(frames_run);
+    Serial.print(',');
+    Serial.print(frame_overruns);
+    Serial.print(',');
+    Serial.print(frames_dropped);
+    Serial.print(',');
+    Serial.println(frame_worst_us);
   }
-  else if (cue == 10) {
-    all_off();
+}
+#endif
+
+#if PROFILE || DC_SERIAL
+// Takes requests coming in over serial.  Anything already under way (a
+// profile record going out, a dot correction table coming in) is carried
+// on with instead, and the next request waits until it's done.
+void serial_poll() {
+  byte request;
+  
+#if PROFILE
+  if (profile_poll()) {
+    return;
+  }
+#endif
+#if DC_SERIAL
+  if (dc_poll()) {
+    return;
+  }
+#endif
+  if (!Serial.available()) {
+    return;
+  }
+  request = Serial.read();
+#if PROFILE
+  if (request == PROFILE_REQUEST) {
+    profile_fill();
+  }
+#endif
+#if DC_SERIAL
+  if (request == DC_REQUEST || request == DC_MEASURED) {
+    dc_receive(request);
+  }
+#endif
+}
+#endif
+
+// Checks whether or not the given LED has finished fading to its 'destination' colour.
+// A 1 means the LED is not fading.
+byte test_not_fading(unsigned int led) {
+#if LAYERS
+  // Just changed in a layer counts as fading, as it will be once it's blended
+  if (layer_dirty[led >> 3] & _BV(led & 7)) {
+    return 0;
   }
+#endif
+  return !(fading[led >> 3] & _BV(led & 7));
+}
+
+// Assign the colours for the background to fade between
+// and the colours for the foreground to fade between, into an
+// effect's colours.
+// fade_style takes the value 0, 1, 2, 3 or 4.
+// 0 means don't change.
+// 1 means randomise the colours along the spectrum; change with time
+// 2 means randomise the colours along the spectrum; change with cycle
+// 3 means smooth fading along the spectrum; change with time
+// 4 means smooth fading along the spectrum, change with cycle.
+// num_increments of 0 is taken as 1.
+void assign_colours(byte *colours,
+					byte r1, byte g1, byte b1,
+					byte r2, byte g2, byte b2,
+					byte r3, byte g3, byte b3,
+					byte fade_style, byte num_increments) {
+  uint32_t step;
+
+  colours[BG_RED] = r1;
+  colours[BG_GREEN] = g1;
+  colours[BG_BLUE] = b1;
+  colours[FG1_RED] = r2;
+  colours[FG1_GREEN] = g2;
+  colours[FG1_BLUE] = b2;
+  colours[FG2_RED] = r3;
+  colours[FG2_GREEN] = g3;
+  colours[FG2_BLUE] = b3;
   
-  else if (cue == 11) {
-    if (auto_advance_counter == 450 || auto_advance_counter == 2850) {
-        
-      anim_count = 0;
-      sub_cue++;
-    }
-        
-    assign_colours(BLACK, RED, ORANGE, 3, 50);
-     
-    if (sub_cue == 0) {
-      runners(7, 1, 0, 0, 0, 1);
-    } else if (sub_cue == 1) {
-      runners(13, 1, 7, 7, 0, 1);
-    } else {
-      pattern_invert(455, 23, 0, 0);
-    }
+  colours[FGC_RED] = r2;
+  colours[FGC_GREEN] = g2;
+  colours[FGC_BLUE] = b2;
+  
+  if (num_increments == 0) {
+    num_increments = 1;
   }
+  colours[FADE_STYLE] = fade_style;
+  colours[NUM_INC] = num_increments;
   
-  else if (cue == 12) {
-    all_off();
+  // 2^24 / num_increments, rounded up but kept to 24 bits.  That's just
+  // close enough for palette_colour() to get every colour of the palette
+  // to the nearest step, and both ends exactly.
+  step = (0xFFFFFFUL + num_increments - 1) / num_increments;
+  colours[PAL_STEP] = step;
+  colours[PAL_STEP + 1] = step >> 8;
+  colours[PAL_STEP + 2] = step >> 16;
+  
+  colours[DIR] = 0;
+  colours[PAL_INDEX] = 0;
+}
+
+// Sets the current foreground colour to colour index of the palette, i.e.
+// index/NUM_INC of the way from foreground 1 to foreground 2.
+// The same sum for every channel, whichever way it's going.
+void palette_colour(byte *colours, byte index) {
+  uint32_t step = colours[PAL_STEP] | (uint16_t)colours[PAL_STEP + 1] << 8
+    | (uint32_t)colours[PAL_STEP + 2] << 16;
+  // How far along, where 65536 is foreground 2
+  int32_t along = (index * step) >> 8;
+  
+  for (byte lane = 0; lane < 3; lane++) {
+    int16_t span = colours[FG2_RED + lane] - colours[FG1_RED + lane];
+    
+    colours[FGC_RED + lane] = colours[FG1_RED + lane] + ((span * along + 0x8000) >> 16);
   }
+}
+
+// This changes the current colour according to the two foreground colours
+// and the fade style, drawing any random numbers from stream
+void perform_spectrum_shifts(byte *colours, uint32_t *stream) {
+  byte last = colours[NUM_INC];
   
-  else if (cue == 13) {
-        
-    if (auto_advance_counter == 5 || auto_advance_counter == 3625) {
-      anim_count = 0;
-      sub_cue++;
-    }
-        
-    assign_colours(BLACK, RED, ORANGE, 2, 10);
-        
-    if (sub_cue == 0) {
-      all_off();
-      auto_advance_counter++;
-    } else if (sub_cue == 1) {
-      fades(113, 0, 4);
-    } else if (sub_cue == 2) {
-      pattern_shift(301, 10, 0, 0, 1, 0);
-    }
+  switch (colours[FADE_STYLE]) {
+    case 1:
+    case 2:
+      // Anywhere in the palette, both ends included
+      colours[PAL_INDEX] = random_below(stream, last + 1);
+      break;
+    case 3:
+    case 4:
+      // One colour on towards the end it's going to, turning round there
+      if (colours[DIR] == 0) {
+        if (++colours[PAL_INDEX] >= last) {
+          colours[DIR] = 1;
+        }
+      } else if (--colours[PAL_INDEX] == 0) {
+        colours[DIR] = 0;
+      }
+      break;
+    default:
+      return;
   }
+  palette_colour(colours, colours[PAL_INDEX]);
+}
+
+/*
+ * Random Numbers
+ * 
+ * Each effect instance has a stream of random numbers of its own, so what
+ * one effect does doesn't change the numbers another gets.  A stream is
+ * xorshift32: 4 bytes of state, and a few shifts a number.
+ * 
+ * The streams are seeded from random_seed (see RANDOM_SEED) as each group
+ * of steps starts, mixed with the step's number and how many groups have
+ * started before it.  So with the same seed and the same cues called, the
+ * show plays exactly the same, but a step that's looped back to gets new
+ * numbers each time round.
+ * 
+ * random_below() gets a number in range by multiplying rather than with
+ * %, which on the AVR is a slow 32 bit division, and throws away the few
+ * numbers that would make some results more likely than others.
+ */
+
+uint32_t random_seed = RANDOM_SEED;
+// How many groups of steps have started, for seeding their streams
+unsigned int groups_started = 0;
+
+// Seeds the show: from RANDOM_SEED if it's been given, otherwise from noise
+// and, with SEED_BOOTS, a count of power-ups
+void seed_random() {
+#if RANDOM_SEED == 0
+  random_seed = 0;
+#if SEED_BOOTS
+  uint32_t boots = 0;
   
-  else if (cue == 14) {
-    all_off();
+  for (byte n = 0; n < 4; n++) {
+    boots |= (uint32_t)EEPROM_READ(SEED_EEPROM + n) << 8*n;
+  }
+  boots++;
+  // Only the bytes that have changed, mostly just the lowest
+  for (byte n = 0; n < 4; n++) {
+    while (!EEPROM_READY());
+    EEPROM_UPDATE(SEED_EEPROM + n, boots >> 8*n);
+  }
+  random_seed = boots;
+#endif
+  // Only the lowest bit of each reading is much use
+  for (byte n = 0; n < 32; n++) {
+    random_seed ^= (uint32_t)(NOISE_READ() & 1) << n;
   }
+#endif
+}
+
+// Spreads the bits of x about, so that seeds next to each other give
+// streams nothing like each other.  Never 0, which xorshift can't leave.
+uint32_t random_mix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x45D9F3B;
+  x ^= x >> 16;
+  x *= 0x45D9F3B;
+  x ^= x >> 16;
+  return x ? x : 1;
+}
+
+// The seed for the stream of step number step, as its group starts
+uint32_t random_stream_seed(unsigned int step) {
+  return random_mix(random_seed ^ ((uint32_t)groups_started << 16) ^ step);
+}
+
+// The next 16 bits of stream
+uint16_t random_next(uint32_t *stream) {
+  uint32_t x = *stream;
   
-  else if (cue == 15) {
-        
-    if (auto_advance_counter == 5 || auto_advance_counter == 3625) {
-      anim_count = 0;
-      sub_cue++;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *stream = x;
+  return x >> 16;
+}
+
+// A random number from 0 to maximum - 1 (0 if maximum is 0), all equally
+// likely.  The top 16 bits of a random number times maximum are in range;
+// the bottom 16 say whether it was one of the 65536 % maximum numbers that
+// land a result one more time than the rest, which are drawn again.
+unsigned int random_below(uint32_t *stream, unsigned int maximum) {
+  uint32_t m = (uint32_t)random_next(stream) * maximum;
+  
+  if ((uint16_t)m < maximum) {
+    uint16_t extra = (uint16_t)(0 - maximum) % maximum;
+    
+    while ((uint16_t)m < extra) {
+      m = (uint32_t)random_next(stream) * maximum;
     }
-        
-    if (sub_cue == 0) {
-      all_off();
-      auto_advance_counter++;
-    } else if (sub_cue == 1) {
-      assign_colours(ORANGE, RED,YELLOW, 2, 10);
-      fades(113, 0, 4);
-    } else if (sub_cue == 2) {
-      assign_colours(ORANGE, BLACK, BLACK, 0, 1);
-      raindrops(10, 1, 20, 5, 0);
+  }
+  return m >> 16;
+}
+
+// Picks count different numbers from 0 to maximum - 1 (all of them if count
+// is more than that) and sets their bits in picked, which the caller
+// provides, (maximum + 7) / 8 bytes of it.  Floyd's way, which draws count
+// numbers however close count is to maximum.  Returns the last one picked.
+unsigned int random_pick(uint32_t *stream, byte *picked, unsigned int count,
+                         unsigned int maximum) {
+  unsigned int n = 0;
+  
+  memset(picked, 0, (maximum + 7) / 8);
+  if (count > maximum) {
+    count = maximum;
+  }
+  for (unsigned int top = maximum - count; top < maximum; top++) {
+    n = random_below(stream, top + 1);
+    // Taken already, so have top instead (which can't be)
+    if (picked[n >> 3] & _BV(n & 7)) {
+      n = top;
     }
+    picked[n >> 3] |= _BV(n & 7);
   }
+  return n;
+}
+
+// ============= Clips =================================================
+
+/*
+ * Clips are cues recorded ahead of time (see RECORD_CUE) and played back
+ * by the playback effect.  Playing a frame only touches the channels that
+ * changed in it, so it costs next to nothing, however much work the
+ * effects that made it were.
+ * 
+ * A clip is its number of frames (LSB first) and then the frames.  Each
+ * frame is a list of runs: how many channels to skip (they stay as they
+ * were), how many channels follow, and then their new values.  A run of
+ * 0 channels ends the frame.  The first frame has every channel, so a clip
+ * can start (and loop back round) from anything.
+ * 
+ * Clips are of channels rather than LEDs, so they don't go through
+ * FIXTURES: one recorded with a different map needs recording again.
+ */
+
+// The CLIP_DEMO pattern_shift cue, recorded with RECORD_SKIP 18 and
+// RECORD_FRAMES 108 (one cycle)
+const byte CLIP_PATTERN_SHIFT_DATA[] PROGMEM = {
+  108, 0,
+  0, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  12, 1, 255, 8, 1, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  9, 1, 255, 8, 1, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  6, 1, 255, 8, 1, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  3, 1, 255, 8, 1, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 1, 255, 8, 1, 0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  3, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  6, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  9, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  12, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  15, 1, 0, 8, 1, 255, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0,
+  0, 0
+};
+
+#define CLIP_PATTERN_SHIFT	0
+
+const byte * const CLIPS[] PROGMEM = {
+  CLIP_PATTERN_SHIFT_DATA
+};
+
+// ============= Cue List ==============================================
+
+/*
+ * The show is a list of cues, and each cue is a list of steps (sub cues)
+ * stored one after another in CUE_STEPS, in flash.  Cue 1 is the first
+ * run of steps, cue 2 the next, and so on; the last step of each cue has
+ * STEP_END set.
+ * 
+ * Every frame, animate() runs the current step: assign_colours() with the
+ * step's colours (if STEP_COLOURS is set), then its effect.
+ * Effects count up auto_advance_counter once a frame as they go, and when
+ * it gets to the step's advance_at, the cue moves on to its next step.
+ * advance_at is in milliseconds (of counting, at one count per FRAME_MS),
+ * so cue timings stay the same if FRAME_MS is changed.  It has to go up
+ * from one step to the next, unless the step resets the counter
+ * (STEP_RESET).  Steps that stay until the next cue is called have
+ * advance_at NEVER; the last step of a cue must be one of these or a loop.
+ * 
+ * A loop step (STEP_LOOP) jumps back to sub cue loop_to with the counter
+ * set to loop_counter (also in milliseconds), and runs its own effect
+ * (if any) on the way.
+ * 
+ * Steps can be grouped to run more than one effect at once: a step with
+ * STEP_WITH set runs alongside the step after it, so a group is the first
+ * step and every step after it up to and including the first one without
+ * STEP_WITH.  Each step of a group gets an effect instance of its own (see
+ * Effect Instances), and up to NUM_EFFECTS of them run; any more are
+ * skipped.  The first step of the group leads it: its advance_at, loop and
+ * counter flags are the ones used, and moving on goes to the step after
+ * the group.  Loops should go to the first step of a group, and STEP_END
+ * goes on the last one.
+ * 
+ * first_led and num_leds say which LEDs the step's effect runs on, so the
+ * steps of a group can each have their own part of the chain (or overlap,
+ * in which case the later one wins).  num_leds of 0 means up to the end of
+ * the chain, so steps that leave both out run on every LED.  With LAYERS,
+ * blend and opacity say how the step's effect goes over the steps before it
+ * in the group (see Layers).
+ * 
+ * Colours are the 11 assign_colours() arguments: background, foreground 1,
+ * foreground 2, fade_style and number of increments.
+ * Effect parameters go in args, in the same order as the effect function
+ * takes them, except that the pattern of pattern_invert and pattern_shift
+ * goes in pattern (see PATTERN_BITS).  Use BACKWARDS for a dir of -1.
+ * 
+ * Adding cues or steps costs flash, but not time; only the current step
+ * (or group) is ever looked at.
+ * 
+ * With SHOW_SD the steps come from a show file instead, so the show can be
+ * changed (and made as long as the card allows) without reflashing.  The
+ * file is the same whatever the sketch is built with or for, and all its
+ * numbers are LSB first:
+ * bytes 0 - 3	"TLCS"
+ * byte 4		SHOW_VERSION
+ * byte 5		SHOW_STEP_BYTES, the size of a step
+ * bytes 6 - 7	number of steps
+ * then the steps, SHOW_STEP_BYTES each:
+ * bytes 0 - 3		advance_at
+ * byte 4			flags
+ * bytes 5 - 15		colours
+ * byte 16			effect
+ * bytes 17 - 18	pattern
+ * bytes 19 - 27	args
+ * byte 28			loop_to
+ * bytes 29 - 32	loop_counter
+ * bytes 33 - 34	first_led
+ * bytes 35 - 36	num_leds
+ * byte 37			blend
+ * byte 38			opacity
+ * byte 39			spare, 0
+ * A file with any other version or size of step isn't played.  Steps are
+ * read into the effect instances (see step_decode()), a group at a time,
+ * when the cue or sub cue changes.  host/showc makes a show file from a
+ * text description of the show (see host/README.md).
+ */
+
+// Step flags
+#define STEP_COLOURS	0x01	// call assign_colours() with colours
+#define STEP_COUNT		0x02	// count auto_advance_counter up by one after the effect
+#define STEP_RESET		0x04	// set auto_advance_counter back to 0 when moving on
+#define STEP_LOOP		0x08	// go back to sub cue loop_to
+#define STEP_END		0x10	// last step of the cue
+#define STEP_WITH		0x20	// the next step runs alongside this one
+
+// Effects
+#define EFFECT_NONE				0
+#define EFFECT_ALL_OFF			1
+#define EFFECT_ALL_ON			2
+#define EFFECT_FADES			3
+#define EFFECT_RUNNERS			4
+#define EFFECT_COUNTING			5
+#define EFFECT_RAINDROPS		6
+#define EFFECT_PATTERN_INVERT	7
+#define EFFECT_PATTERN_SHIFT	8
+#define EFFECT_BINARY_COUNTER	9
+#define EFFECT_PLAYBACK			10	// args[0] is the clip number
+
+#define NEVER			0xFFFFFFFF
+#define BACKWARDS		0xFF
+
+// Blend modes (see Layers)
+#define BLEND_REPLACE	0
+#define BLEND_ADD		1
+#define BLEND_MAX		2
+#define BLEND_MULTIPLY	3
+#define BLEND_ALPHA		4
+
+struct cue_step {
+  uint32_t advance_at;
+  byte flags;
+  byte colours[11];
+  byte effect;
+  uint16_t pattern;
+  byte args[9];
+  byte loop_to;
+  uint32_t loop_counter;
+  uint16_t first_led;
+  uint16_t num_leds;
+  byte blend;
+  byte opacity;
+};
+
+// I've left my cues as examples of how you might programme a show.
+// A step only needs the fields up to the last one it uses; the rest are 0,
+// so -Wextra isn't told about every one left out.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+const struct cue_step CUE_STEPS[] PROGMEM = {
+  // Cue 1
+  {2000, STEP_COLOURS, {BLACK, RED, RED, 0, 1}, EFFECT_ALL_ON, 0, {0, 0}},
+  {4000, STEP_COLOURS, {BLACK, GREEN, GREEN, 0, 1}, EFFECT_ALL_ON, 0, {0, 0}},
+  {6000, STEP_COLOURS, {BLACK, BLUE, BLUE, 0, 0}, EFFECT_ALL_ON, 0, {0, 0}},
+  {NEVER, STEP_LOOP | STEP_END, {0}, EFFECT_NONE, 0, {0}, 0, 0},
+  // Cue 2
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 3
+  {16000, STEP_COLOURS, {BLACK, BLUE, WHITE, 1, 255}, EFFECT_RAINDROPS, 0, {1, 1, 15, 5, 0}},
+  {24000, STEP_COLOURS, {BLACK, BLUE, WHITE, 4, 255}, EFFECT_PATTERN_SHIFT, 448, {9, 0, 0, 1, 1}},
+  {32000, STEP_COLOURS, {BLACK, BLUE, WHITE, 3, 255}, EFFECT_PATTERN_INVERT, 341, {30, 0, 0}},
+  {40000, STEP_COLOURS, {BLACK, BLUE, WHITE, 3, 255}, EFFECT_RUNNERS, 0, {7, 1, 25, 8, 0, 0}},
+  {NEVER, STEP_LOOP | STEP_END, {0}, EFFECT_NONE, 0, {0}, 1, 16008},
+  // Cue 4
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 5
+  {12480, STEP_COLOURS, {0, 50, 0, 0, 0, 50, GREEN, 0, 255}, EFFECT_FADES, 0, {29, 3, 3}},
+  {13280, STEP_COLOURS, {BLUE, BLUE, GREEN, 0, 255}, EFFECT_ALL_ON, 0, {3, 3}},
+  {18400, STEP_COLOURS, {0, 50, 0, 0, 0, 50, GREEN, 0, 255}, EFFECT_FADES, 0, {29, 3, 3}},
+  {19200, STEP_COLOURS, {BLUE, GREEN, GREEN, 0, 255}, EFFECT_ALL_ON, 0, {3, 3}},
+  {20000, STEP_COLOURS, {0, 50, 0, 0, 0, 50, GREEN, 0, 255}, EFFECT_FADES, 0, {29, 3, 3}},
+  {20800, STEP_COLOURS, {BLUE, BLUE, GREEN, 0, 255}, EFFECT_ALL_ON, 0, {3, 3}},
+  {24800, STEP_COLOURS, {0, 50, 0, 0, 0, 50, GREEN, 0, 255}, EFFECT_FADES, 0, {29, 3, 3}},
+  {36960, STEP_COLOURS, {BLACK, BLUE, GREEN, 1, 255}, EFFECT_FADES, 0, {32, 0, 0}},
+  {NEVER, STEP_COLOURS, {BLACK, BLUE, GREEN, 2, 255}, EFFECT_RUNNERS, 0, {3, 1, 0, 30, 0, 1}},
+  {NEVER, STEP_LOOP | STEP_END, {0}, EFFECT_NONE, 0, {0}, 0, 0},
+  // Cue 6
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 7
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, BLUE, PINK, 1, 255}, EFFECT_RAINDROPS, 0, {15, 2, 5, 5, 1}},
+  // Cue 8
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 9
+  {1760, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {1920, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 5}},
+  {3440, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_FADES, 0, {45, 7, 7}},
+  {3600, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 0}},
+  {3760, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {3920, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 2}},
+  {5200, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {5360, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 5}},
+  {6880, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_FADES, 0, {45, 7, 7}},
+  {7040, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 0}},
+  {7200, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {7360, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 2}},
+  {8640, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {8800, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 5}},
+  {10320, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_FADES, 0, {45, 7, 7}},
+  {10480, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 0}},
+  {10640, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {10800, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 2}},
+  {12080, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {12240, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 5}},
+  {13760, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_FADES, 0, {45, 7, 7}},
+  {13920, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 0}},
+  {14080, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {14240, STEP_COLOURS, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_ON, 0, {0, 2}},
+  {15520, STEP_COLOURS | STEP_COUNT, {BLACK, RED, PINK, 1, 255}, EFFECT_ALL_OFF},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, RED, PINK, 1, 255}, EFFECT_RAINDROPS, 0, {1, 1, 20, 20, 0}},
+  // Cue 10
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 11
+  {3600, STEP_COLOURS, {BLACK, RED, ORANGE, 3, 50}, EFFECT_RUNNERS, 0, {7, 1, 0, 0, 0, 1}},
+  {22800, STEP_COLOURS, {BLACK, RED, ORANGE, 3, 50}, EFFECT_RUNNERS, 0, {13, 1, 7, 7, 0, 1}},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, RED, ORANGE, 3, 50}, EFFECT_PATTERN_INVERT, 455, {23, 0, 0}},
+  // Cue 12
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 13
+  {40, STEP_COLOURS | STEP_COUNT, {BLACK, RED, ORANGE, 2, 10}, EFFECT_ALL_OFF},
+  {29000, STEP_COLOURS, {BLACK, RED, ORANGE, 2, 10}, EFFECT_FADES, 0, {113, 0, 4}},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, RED, ORANGE, 2, 10}, EFFECT_PATTERN_SHIFT, 301, {10, 0, 0, 1, 0}},
+  // Cue 14
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 15
+  {40, STEP_COUNT, {0}, EFFECT_ALL_OFF},
+  {29000, STEP_COLOURS, {ORANGE, RED, YELLOW, 2, 10}, EFFECT_FADES, 0, {113, 0, 4}},
+  {NEVER, STEP_COLOURS | STEP_END, {ORANGE, BLACK, BLACK, 0, 1}, EFFECT_RAINDROPS, 0, {10, 1, 20, 5, 0}},
+  // Cue 16
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 17
+  {40, STEP_COLOURS | STEP_COUNT, {BLACK, BLACK, WHITE, 3, 20}, EFFECT_NONE},
+  {920, STEP_COLOURS, {BLACK, BLACK, WHITE, 3, 20}, EFFECT_FADES, 0, {2, 0, 0}},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, BLACK, WHITE, 3, 20}, EFFECT_ALL_OFF},
+  // Cue 18
+  {11200, STEP_COLOURS, {BLACK, RED, ORANGE, 3, 20}, EFFECT_RUNNERS, 0, {8, 1, 9, 9, 0, 0}},
+  {40000, STEP_COLOURS, {BLACK, RED, ORANGE, 3, 20}, EFFECT_COUNTING, 0, {100, BACKWARDS, 10, 2, 1, 1, 0, 0, 0}},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, RED, ORANGE, 3, 20}, EFFECT_ALL_OFF},
+  // Cue 19
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 20
+  {NEVER, STEP_COLOURS | STEP_END, {0, 0, 80, BLACK, WHITE, 1, 255}, EFFECT_RAINDROPS, 0, {50, 1, 6, 3, 0}},
+  // Cue 21
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 22
+  {NEVER, STEP_COLOURS | STEP_END, {0, 0, 80, WHITE, WHITE, 0, 255}, EFFECT_RUNNERS, 0, {35, 1, 5, 1, 1, 0}},
+  // Cue 23
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 24
+  {5480, STEP_COLOURS, {BLACK, RED, ORANGE, 2, 20}, EFFECT_FADES, 0, {118, 0, 2}},
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, RED, ORANGE, 2, 20}, EFFECT_COUNTING, 0, {237, BACKWARDS, 0, 0, 1, 0, 0, 0, 0}},
+  // Cue 25
+  {NEVER, STEP_END, {0}, EFFECT_ALL_OFF},
+  // Cue 26
+  {8000, STEP_COLOURS | STEP_RESET, {BLACK, RED, GREEN, 3, 50}, EFFECT_RAINDROPS, 0, {20, 2, 20, 10, 0}},
+  {8000, STEP_COLOURS | STEP_RESET, {BLACK, GREEN, BLUE, 3, 50}, EFFECT_RAINDROPS, 0, {20, 2, 20, 10, 0}},
+  {8000, STEP_COLOURS | STEP_RESET, {BLACK, BLUE, RED, 3, 50}, EFFECT_RAINDROPS, 0, {20, 2, 20, 10, 0}},
+  {NEVER, STEP_LOOP | STEP_END, {0}, EFFECT_RAINDROPS, 0, {20, 2, 20, 10, 0}, 0, 0},
+#if CLIP_DEMO
+  // Cue 27
+  {NEVER, STEP_COLOURS | STEP_END, {BLACK, BLUE, WHITE, 0, 1}, EFFECT_PATTERN_SHIFT, 448, {9, 0, 0, 1, 1}},
+  // Cue 28 - cue 27 again, played from a recording
+  {NEVER, STEP_END, {0}, EFFECT_PLAYBACK, 0, {CLIP_PATTERN_SHIFT}},
+#endif
+};
+#pragma GCC diagnostic pop
+
+#define NUM_STEPS		(sizeof(CUE_STEPS) / sizeof(CUE_STEPS[0]))
+#define NO_STEP			0xFFFF
+#define SHOW_HEADER		8
+#define SHOW_VERSION	5
+#define SHOW_STEP_BYTES	40
+#define SHOW_STEP_FLAGS	4	// where flags are in a step
+
+// Number of steps in the show being played
+unsigned int show_steps = NUM_STEPS;
+#if SHOW_SOURCE == SHOW_SD
+// Set if the show is being read from the card rather than CUE_STEPS
+byte show_on_sd = 0;
+#endif
+
+// The cue the step below was found for, and where its first step is
+// (NO_STEP if there is no such cue)
+int loaded_cue = -1;
+unsigned int cue_first_step = NO_STEP;
+// The number of the step leading the group being run, how many steps are
+// in the group, and the lead's advance_at in frames
+unsigned int loaded_step = NO_STEP;
+byte step_group = 0;
+unsigned long step_advance = NEVER;
+
+/*
+ * Effect Instances
+ * 
+ * Each step being run has an effect instance: the step itself, the LEDs
+ * it runs on (first and count, worked out from first_led and num_leds),
+ * and everything its effect keeps from one frame to the next.  anim_count
+ * counts the effect's frames since the step started (0 is the first frame,
+ * when it sets itself up), off_speed is what all_off() fades at, colours
+ * is the effect's own set of colours (see assign_colours()), random its
+ * stream of random numbers (see Random Numbers), and s holds whatever else
+ * the effect needs, one struct per effect.
+ * 
+ * effects[0] is always the lead step of the group, and it's the only one
+ * that counts auto_advance_counter (see count_frame()), so the cue timings
+ * come from it alone.
+ * 
+ * All the instances write into the one set of LEDs, and perform_fades()
+ * does a single pass over them a frame for all of them together, so
+ * running more effects at once only costs the effects themselves.
+ */
+struct effect {
+  struct cue_step step;
+  unsigned int first;
+  unsigned int count;
+  unsigned int anim_count;
+  byte off_speed;
+  byte colours[COLOURS_SIZE];
+  uint32_t random;
+  union {
+    struct {
+      unsigned int led_num;
+      int8_t reversed;
+    } runners;
+    struct {
+      unsigned int led_num;
+      int8_t reversed;
+      byte fade_in;
+      byte state;
+    } counting;
+    struct {
+      unsigned int led_num;
+      byte continu;
+    } raindrops;
+    struct {
+      uint16_t pattern;
+      signed char dir;
+    } pattern;
+    struct {
+      const byte *start;
+      const byte *frame;
+      unsigned int frames_left;
+      unsigned int next_ms;
+    } playback;
+  } s;
+};
+
+struct effect effects[NUM_EFFECTS];
+// How many of effects are running the current group
+byte effects_running = 0;
+
+// This function is where the animation functions are called from.
+// It runs one frame of the current step (or group) of the current cue, and
+// any frames that were dropped before it (see CATCH_UP_FRAMES), so step
+// timings and effects count every frame of the show, run or not.
+void animate() {
+  for (byte n = 0; n <= frames_behind; n++) {
+    animate_frame();
+  }
+  frames_behind = 0;
+#if LAYERS
+  drawing_layer = NO_LAYER;
+  blend_layers();
+#endif
+}
+
+// One frame of animate()
+void animate_frame() {
+  struct cue_step *step = &effects[0].step;
   
-  else if (cue == 16) {
-    all_off();
+  if (cue != loaded_cue) {
+    loaded_cue = cue;
+    cue_first_step = find_cue(cue);
+  }
+  if (!load_step()) {
+    return;
   }
   
-  else if (cue == 17) {
-    if (auto_advance_counter == 5 || auto_advance_counter == 115) {
-      anim_count = 0;
-      sub_cue++;
+  if (step_advance != NEVER && auto_advance_counter == step_advance) {
+    restart_effects();
+    sub_cue += step_group;
+    if (step->flags & STEP_RESET) {
+      auto_advance_counter = 0;
     }
-        
-    assign_colours(BLACK, BLACK, WHITE, 3, 20);
-        
-    if (sub_cue == 0) {
-      auto_advance_counter++;
-    } else if (sub_cue == 1) {
-      fades(2, 0, 0);
-    } else if (sub_cue == 2) {
-      all_off();
+    if (!load_step()) {
+      return;
     }
   }
   
-  else if (cue == 18) {
-    if (auto_advance_counter == 1400 || auto_advance_counter == 5000) {
-      anim_count = 0;
-      sub_cue++;
-    }
-        
-    assign_colours(BLACK, RED, ORANGE, 3, 20);
-        
-    if (sub_cue == 0) {
-      runners(8, 1, 9, 9, 0, 0);
-    } else if (sub_cue == 1) {
-      counting(100, -1, 10, 2, 1, 1, 0, 0, 0);
-    } else if (sub_cue == 2) {
-      all_off();
+  if (step->flags & STEP_LOOP) {
+    sub_cue = step->loop_to;
+    auto_advance_counter = step->loop_counter / FRAME_MS;
+  }
+  for (byte e = 0; e < effects_running; e++) {
+    struct effect *fx = &effects[e];
+    const byte *c = fx->step.colours;
+    
+    if (fx->anim_count == 0 && (fx->step.flags & STEP_COLOURS)) {
+      assign_colours(fx->colours, c[0], c[1], c[2], c[3], c[4], c[5],
+                     c[6], c[7], c[8], c[9], c[10]);
     }
+#if LAYERS
+    drawing_layer = e;
+#endif
+    run_effect(fx);
   }
-  
-  else if (cue == 19) {
-    all_off();
+  if (step->flags & STEP_COUNT) {
+    auto_advance_counter++;
   }
+}
+
+// Finds the first step of cue number c, or NO_STEP if the list
+// doesn't go that far.  Only done when the cue changes.
+unsigned int find_cue(int c) {
+  unsigned int step = 0;
   
-  else if (cue == 20) {
-    assign_colours(0, 0, 80, BLACK, WHITE, 1, 255);
-    raindrops(50, 1, 6, 3, 0);
+  if (c < 1) {
+    return NO_STEP;
+  }
+  for (int n = 1; n < c && step < show_steps; step++) {
+    if (step_flags(step) & STEP_END) {
+      n++;
+    }
   }
+  return step < show_steps ? step : NO_STEP;
+}
+
+// Loads the group of steps starting at step sub_cue of the current cue into
+// the effect instances, reading it in only if it isn't the one already there.
+// Returns 0 if the show has no such step or cue (or it can't be read), and
+// then the next step asked for is read in afresh, even if it's the one that
+// was there before.
+byte load_step() {
+  unsigned int index = cue_first_step + sub_cue;
+  byte flags;
   
-  else if (cue == 21) {
-    all_off();
+  if (cue_first_step == NO_STEP || index >= show_steps) {
+    loaded_step = NO_STEP;
+    return 0;
   }
+  if (index != loaded_step) {
+    loaded_step = NO_STEP;
+    effects_running = 0;
+    step_group = 0;
+    do {
+      if (effects_running < NUM_EFFECTS) {
+        struct effect *fx = &effects[effects_running];
+        
+        if (!read_step(index + step_group, &fx->step)) {
+          return 0;
+        }
+        effect_range(fx);
+        fx->random = random_stream_seed(index + step_group);
+        effects_running++;
+        flags = fx->step.flags;
+      } else {
+        flags = step_flags(index + step_group);
+      }
+      step_group++;
+    } while ((flags & STEP_WITH) && !(flags & STEP_END)
+             && index + step_group < show_steps);
+    loaded_step = index;
+    groups_started++;
+#if LAYERS
+    reset_layers();
+#endif
+    step_advance = effects[0].step.advance_at;
+    if (step_advance != NEVER) {
+      step_advance /= FRAME_MS;
+    }
+  }
+  return 1;
+}
+
+// Copies step number index of the show into step
+byte read_step(unsigned int index, struct cue_step *step) {
+#if SHOW_SOURCE == SHOW_SD
+  if (show_on_sd) {
+    byte raw[SHOW_STEP_BYTES];
+    
+    if (!show_read(SHOW_HEADER + (unsigned long)index * SHOW_STEP_BYTES, raw, SHOW_STEP_BYTES)) {
+      return 0;
+    }
+    step_decode(raw, step);
+    return 1;
+  }
+#endif
+  memcpy_P(step, &CUE_STEPS[index], sizeof(*step));
+  return 1;
+}
+
+// The flags of step number index of the show, without reading the rest
+byte step_flags(unsigned int index) {
+#if SHOW_SOURCE == SHOW_SD
+  byte flags = STEP_END;
   
-  else if (cue == 22) {
-    assign_colours(0, 0, 80, WHITE, WHITE, 0, 255);
-    runners(35, 1, 5, 1, 1, 0);
+  if (show_on_sd) {
+    show_read(SHOW_HEADER + (unsigned long)index * SHOW_STEP_BYTES + SHOW_STEP_FLAGS,
+      &flags, 1);
+    return flags;
   }
+#endif
+  return pgm_read_byte(&CUE_STEPS[index].flags);
+}
+
+// Calls the effect of fx's step with its parameters
+void run_effect(struct effect *fx) {
+  const byte *a = fx->step.args;
   
-  else if (cue == 23) {
-    all_off();
+  switch (fx->step.effect) {
+    case EFFECT_ALL_OFF: all_off(fx); break;
+    case EFFECT_ALL_ON: all_on(fx, a[0], a[1]); break;
+    case EFFECT_FADES: fades(fx, a[0], a[1], a[2]); break;
+    case EFFECT_RUNNERS: runners(fx, a[0], a[1], a[2], a[3], a[4], a[5]); break;
+    case EFFECT_COUNTING: counting(fx, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]); break;
+    case EFFECT_RAINDROPS: raindrops(fx, a[0], a[1], a[2], a[3], a[4]); break;
+    case EFFECT_PATTERN_INVERT: pattern_invert(fx, fx->step.pattern, a[0], a[1], a[2]); break;
+    case EFFECT_PATTERN_SHIFT: pattern_shift(fx, fx->step.pattern, a[0], a[1], a[2], a[3], a[4]); break;
+    case EFFECT_BINARY_COUNTER: binary_counter(fx, a[0], a[1], a[2]); break;
+    case EFFECT_PLAYBACK: playback(fx, a[0]); break;
   }
+}
+
+// Works out which LEDs fx runs on from its step's first_led and num_leds
+void effect_range(struct effect *fx) {
+  unsigned int rest;
   
-  else if (cue == 24) {
-    if (auto_advance_counter == 685) {
-      anim_count = 0;
-      sub_cue++;
-    }
-        
-    assign_colours(BLACK, RED, ORANGE, 2, 20);
-        
-    if (sub_cue == 0) {
-      fades(118, 0, 2);
-    } else {
-      counting(237, -1, 0, 0, 1, 0, 0, 0, 0);
+  fx->first = fx->step.first_led < NUM_LED ? fx->step.first_led : NUM_LED - 1;
+  rest = NUM_LED - fx->first;
+  fx->count = (fx->step.num_leds == 0 || fx->step.num_leds > rest) ? rest : fx->step.num_leds;
+}
+
+// Starts every effect instance again from its first frame
+void restart_effects() {
+  for (byte e = 0; e < NUM_EFFECTS; e++) {
+    effects[e].anim_count = 0;
+  }
+}
+
+// Effects call this once a frame as they go.  Only the lead of the group
+// counts auto_advance_counter up, so the others can't move the cue on.
+void count_frame(struct effect *fx) {
+  if (fx == effects) {
+    auto_advance_counter++;
+  }
+}
+
+// led_set_all() for just the LEDs of fx
+void effect_set_all(struct effect *fx, byte R_A, byte G_A, byte B_A, byte fade_a) {
+  for (unsigned int led = fx->first; led < fx->first + fx->count; led++) {
+    led_set_new(led, R_A, G_A, B_A, fade_a);
+  }
+}
+
+// Whether any of fx's LEDs are still fading
+byte effect_fading(struct effect *fx) {
+  // leds_fading doesn't know about LEDs waiting to be blended
+  if (fx->count == NUM_LED && !LAYERS) {
+    return leds_fading != 0;
+  }
+  for (unsigned int led = fx->first; led < fx->first + fx->count; led++) {
+    if (!test_not_fading(led)) {
+      return 1;
     }
   }
+  return 0;
+}
 
-  else if (cue == 25) {
-    all_off();
+#if SHOW_SOURCE == SHOW_SD
+// Checks the header of the show file opened by init_sd() (card_ok says
+// whether it managed to), and plays the show from it if it's good.
+void open_show(byte card_ok) {
+  byte header[SHOW_HEADER];
+  
+  if (card_ok && show_read(0, header, SHOW_HEADER)
+      && memcmp(header, "TLCS", 4) == 0 && header[4] == SHOW_VERSION
+      && header[5] == SHOW_STEP_BYTES) {
+    show_on_sd = 1;
+    show_steps = show_number(header + 6, 2);
   }
+}
+
+// The bytes LSB first number of bytes at raw
+uint32_t show_number(const byte *raw, byte bytes) {
+  uint32_t n = 0;
   
-  else if (cue == 26) {
-	if (auto_advance_counter == 1000) {
-      anim_count = 0;
-      auto_advance_counter = 0;
-      sub_cue++;
-    }
-        
-    if (sub_cue == 0) {
-      assign_colours(BLACK, RED, GREEN, 3, 50);
-    } else if (sub_cue == 1) {
-      assign_colours(BLACK, GREEN, BLUE, 3, 50);
-    } else if (sub_cue == 2) {
-      assign_colours(BLACK, BLUE, RED, 3, 50);
-    } else {
-	  sub_cue = 0;
-	  auto_advance_counter = 0;
-	}
-    
-    raindrops(20, 2, 20, 10, 0);
+  while (bytes--) {
+    n = (n << 8) | raw[bytes];
   }
-//  } else if (cue == 50) {
-//	assign_colours(BLACK, RED, PINK, 3, 255);
-//	runners(10, 1, 7, 7, 0, 1);
-//  } else {
-//    all_off();
-//  }
+  return n;
 }
 
-void all_off() {
-  led_set_all(0, 0, 0, off_speed);
+// Puts n into bytes bytes at raw, LSB first
+void show_put_number(byte *raw, uint32_t n, byte bytes) {
+  for (byte b = 0; b < bytes; b++) {
+    raw[b] = n >> (8 * b);
+  }
 }
 
-// Checks whether or not the given LED has finished fading to its 'destination' colour.
-// A 1 means the LED is not fading.
-byte test_not_fading(byte led) {
-  if (get_led_red(led) == get_new_led_red(led) 
-    && get_led_green(led) == get_new_led_green(led) 
-    && get_led_blue(led) == get_new_led_blue(led)) {
-	
-	return 1;
-  } else {
-	return 0;
+// Unpacks a step from its SHOW_STEP_BYTES in the show file (see Cue List)
+void step_decode(const byte *raw, struct cue_step *step) {
+  step->advance_at = show_number(raw, 4);
+  step->flags = raw[SHOW_STEP_FLAGS];
+  memcpy(step->colours, raw + 5, sizeof(step->colours));
+  step->effect = raw[16];
+  step->pattern = show_number(raw + 17, 2);
+  memcpy(step->args, raw + 19, sizeof(step->args));
+  step->loop_to = raw[28];
+  step->loop_counter = show_number(raw + 29, 4);
+  step->first_led = show_number(raw + 33, 2);
+  step->num_leds = show_number(raw + 35, 2);
+  step->blend = raw[37];
+  step->opacity = raw[38];
+}
+
+// And packs one up to go in the file
+void step_encode(const struct cue_step *step, byte *raw) {
+  show_put_number(raw, step->advance_at, 4);
+  raw[SHOW_STEP_FLAGS] = step->flags;
+  memcpy(raw + 5, step->colours, sizeof(step->colours));
+  raw[16] = step->effect;
+  show_put_number(raw + 17, step->pattern, 2);
+  memcpy(raw + 19, step->args, sizeof(step->args));
+  raw[28] = step->loop_to;
+  show_put_number(raw + 29, step->loop_counter, 4);
+  show_put_number(raw + 33, step->first_led, 2);
+  show_put_number(raw + 35, step->num_leds, 2);
+  raw[37] = step->blend;
+  raw[38] = step->opacity;
+  raw[39] = 0;
+}
+
+#ifndef TLC_HAL_EXTERNAL
+File show_file;
+
+// Starts the SD card and opens SHOW_FILE, writing CUE_STEPS to it first
+// if there isn't one.  Returns 0 if either fails.
+// SD.begin() makes pin 10 (BLANK) an output and leaves the SPI on, so
+// both are put back as they were for the rest of setup().
+byte init_sd() {
+  byte ok = SD.begin(SD_CS);
+  
+  if (ok) {
+    if (!SD.exists(SHOW_FILE)) {
+      save_show();
+    }
+    show_file = SD.open(SHOW_FILE);
+    ok = show_file ? 1 : 0;
   }
+  DDRB &= ~_BV(BLANK);
+  SPCR = 0;
+  return ok;
 }
 
-// Assign the colours for the background to fade between
-// and the colours for the foreground to fade between.
-// fade_style takes the value 0, 1, 2, 3 or 4.
-// 0 means don't change.
-// 1 means randomise the colours along the spectrum; change with time
-// 2 means randomise the colours along the spectrum; change with cycle
-// 3 means smooth fading along the spectrum; change with time
-// 4 means smooth fading along the spectrum, change with cycle.
-void assign_colours(byte r1, byte g1, byte b1,
-					byte r2, byte g2, byte b2,
-					byte r3, byte g3, byte b3,
-					byte fade_style, byte num_increments) {
+// Writes CUE_STEPS out as a new show file
+void save_show() {
+  File file = SD.open(SHOW_FILE, FILE_WRITE);
+  struct cue_step step;
+  byte raw[SHOW_STEP_BYTES];
+  byte header[SHOW_HEADER] = {'T', 'L', 'C', 'S', SHOW_VERSION, SHOW_STEP_BYTES,
+                              NUM_STEPS & 0xFF, NUM_STEPS >> 8};
+  
+  if (!file) {
+    return;
+  }
+  file.write(header, SHOW_HEADER);
+  for (unsigned int n = 0; n < NUM_STEPS; n++) {
+    memcpy_P(&step, &CUE_STEPS[n], sizeof(step));
+    step_encode(&step, raw);
+    file.write(raw, SHOW_STEP_BYTES);
+  }
+  file.close();
+}
 
-  if (anim_count == 0) {
-    colours[BG_RED] = r1;
-    colours[BG_GREEN] = g1;
-    colours[BG_BLUE] = b1;
-    colours[FG1_RED] = r2;
-    colours[FG1_GREEN] = g2;
-    colours[FG1_BLUE] = b2;
-    colours[FG2_RED] = r3;
-    colours[FG2_GREEN] = g3;
-    colours[FG2_BLUE] = b3;
-    
-    colours[FGC_RED] = r2;
-    colours[FGC_GREEN] = g2;
-    colours[FGC_BLUE] = b2;
+// Reads length bytes from offset in the show file into buf.
+// The card shares SIN and SCLK with the TLCs, so this waits for the last
+// frame to be latched before using them; anything the card clocks into the
+// TLCs is then pushed out by the next frame before it can be latched.
+// Afterwards the SPI is put back the way it was.
+byte show_read(unsigned long offset, void *buf, unsigned int length) {
+  byte spcr = SPCR;
+  byte spsr = SPSR;
+  byte ok;
   
-    colours[FADE_STYLE] = fade_style;
-    colours[NUM_INC] = num_increments;
+  while (gs_pending || gs_shifting || data_waiting) IRQ_WAIT();
+  ok = show_file.seek(offset) && show_file.read(buf, length) == (int)length;
+  SPCR = spcr;
+  SPSR = spsr;
+  return ok;
+}
+#endif
+#endif
+
+// ============= Layers ================================================
+
+#if LAYERS
+/*
+ * With LAYERS each effect instance draws into a layer of its own rather than
+ * the frame: while it runs, led_set_new() just notes the colour (and fade) in
+ * its layer.  Then blend_layers() puts the layers together, from effects[0]
+ * up, and sets the frame fading to the result, once a frame just before
+ * perform_fades().  Only the LEDs that changed in some layer are blended,
+ * and each one goes through every layer in one go, so a frame where nothing
+ * changes costs next to nothing however many layers there are.
+ * 
+ * The lead step's layer is the base, and covers the whole chain: LEDs it
+ * hasn't set stay as it last left them, as they would without layers.  Each
+ * of the layers above only covers its effect's LEDs, and goes over what's
+ * below it by its step's blend mode:
+ * BLEND_REPLACE	its own colour; opacity isn't used
+ * BLEND_ADD		the two added, up to 255
+ * BLEND_MAX		the brighter of the two, channel by channel
+ * BLEND_MULTIPLY	the two multiplied, with 255 as 1, e.g. to darken
+ * BLEND_ALPHA		its own colour
+ * and the result is then mixed with what's below by opacity, from 0 (can't
+ * be seen) to 255 (all of it), except with BLEND_REPLACE.  The LED fades
+ * to the blend at the speed of whichever layer changed it last.
+ * 
+ * When a group starts, the base starts from where the frame was heading
+ * and the other layers start off black.
+ * Effects that wait for their LEDs to get somewhere (runners and counting
+ * with wait set) look at the frame, i.e. the blend, so on anything but a
+ * replace layer they can wait a long time.
+ * Clips set the channels themselves, so while the lead step is playback
+ * nothing is blended.
+ */
+
+// Notes the colour (and fade) an effect gave LED led in layer, and marks
+// the LED to be blended again if it changed
+void layer_set(byte layer, unsigned int led, byte R, byte G, byte B, byte fade) {
+  byte *rgb = &layer_rgb[layer][3*led];
   
-    colours[INC_RED] = abs(r2 - r3)/num_increments;  
-    colours[INC_GREEN] = abs(g2 - g3)/num_increments;
-    colours[INC_BLUE] = abs(b2 - b3)/num_increments;	
-    
-    if (fade_style != 0) {
-      if (colours[INC_RED] == 0 && r2 != r3) {
-        colours[INC_RED] = 1;
-      }
-      if (colours[INC_GREEN] == 0 && g2 != g3) {
-        colours[INC_GREEN] = 1;
-      }
-      if (colours[INC_BLUE] == 0 && b2 != b3) {
-        colours[INC_BLUE] = 1;
-      }
-    }
-    
-    colours[DIR] = 0;
-  }			
+  if (rgb[0] == R && rgb[1] == G && rgb[2] == B) {
+    return;
+  }
+  rgb[0] = R;
+  rgb[1] = G;
+  rgb[2] = B;
+  layer_fade[led] = fade;
+  layer_dirty[led >> 3] |= _BV(led & 7);
 }
 
-// This changes the current colour according to the two foreground colours
-// and the fade style
-void perform_spectrum_shifts() {
-  if (colours[FADE_STYLE] != 0) {
-    if (colours[FADE_STYLE] == 1 || colours[FADE_STYLE] == 2) {
-	  byte ran = random_number(colours[NUM_INC] + 1);
-	  
-	  if (ran != NUM_INC) {
-	    if (colours[FG1_RED] < colours[FG2_RED]) {
-	      colours[FGC_RED] = colours[FG1_RED] + colours[INC_RED] * ran;
-        } else {
-	  	  colours[FGC_RED] = colours[FG1_RED] - colours[INC_RED] * ran;
-	  	}
-	  } else {
-		colours[FGC_RED] = colours[FG2_RED];
-	  }
-	  
-	  if (ran != NUM_INC) {
-	    if (colours[FG1_GREEN] < colours[FG2_GREEN]) {
-	      colours[FGC_GREEN] = colours[FG1_GREEN] + colours[INC_GREEN] * ran;
-        } else {
-		  colours[FGC_GREEN] = colours[FG1_GREEN] - colours[INC_GREEN] * ran;
-	    }
-	  } else {
-		colours[FGC_GREEN] = colours[FG2_GREEN];
-	  }
-	  
-	  if (ran != NUM_INC) {
-	    if (colours[FG1_BLUE] < colours[FG2_BLUE]) {
-	      colours[FGC_BLUE] = colours[FG1_BLUE] + colours[INC_BLUE] * ran;
-        } else {
-		  colours[FGC_BLUE] = colours[FG1_BLUE] - colours[INC_BLUE] * ran;
-	    }
-	  } else {
-		colours[FGC_BLUE] = colours[FG2_BLUE];
-	  }
-    } else if (colours[FADE_STYLE] == 3 || colours[FADE_STYLE] == 4) {
-	  if (colours[DIR] == 0) {
-		if (colours[NUM_INC] == 1) {
-		  colours[DIR] = 1;
-		  colours[FGC_RED] = colours[FG2_RED];
-		  colours[FGC_GREEN] = colours[FG2_GREEN];
-		  colours[FGC_BLUE] = colours[FG2_BLUE];
-		} else {
-		  if (colours[FG1_RED] < colours[FG2_RED]) {
-		    if (colours[FG2_RED] - colours[FGC_RED] < colours[INC_RED]) {
-	          colours[FGC_RED] = colours[FG2_RED];
-	          colours[DIR] = 1;
-	        } else {
-			  colours[FGC_RED] += colours[INC_RED];
-		    }
-          } else {
-	  	    if (colours[FGC_RED] - colours[FG2_RED] < colours[INC_RED]) {
-	          colours[FGC_RED] = colours[FG2_RED];
-	          colours[DIR] = 1;
-	        } else {
-			  colours[FGC_RED] -= colours[INC_RED];
-		    }
-	  	  }
-	  	
-	  	  if (colours[FG1_GREEN] < colours[FG2_GREEN]) {
-		    if (colours[FG2_GREEN] - colours[FGC_GREEN] < colours[INC_GREEN]) {
-	          colours[FGC_GREEN] = colours[FG2_GREEN];
-	          colours[DIR] = 1;
-	        } else {
-			  colours[FGC_GREEN] += colours[INC_GREEN];
-		    }
-          } else {
-	  	    if (colours[FGC_GREEN] - colours[FG2_GREEN] < colours[INC_GREEN]) {
-	          colours[FGC_GREEN] = colours[FG2_GREEN];
-	          colours[DIR] = 1;
-	        } else {
-			  colours[FGC_GREEN] -= colours[INC_GREEN];
-		    }
-	  	  }
-	  	
-	  	  if (colours[FG1_BLUE] < colours[FG2_BLUE]) {
-		    if (colours[FG2_BLUE] - colours[FGC_BLUE] < colours[INC_BLUE]) {
-	          colours[FGC_BLUE] = colours[FG2_BLUE];
-	          colours[DIR] = 1;
-	        } else {
-			  colours[FGC_BLUE] += colours[INC_BLUE];
-		    }
-          } else {
-	  	    if (colours[FGC_BLUE] - colours[FG2_BLUE] < colours[INC_BLUE]) {
-	          colours[FGC_BLUE] = colours[FG2_BLUE];
-	          colours[DIR] = 1;
-  	        } else {
-			  colours[FGC_BLUE] -= colours[INC_BLUE];
-		    }
-	  	  }
-	    }
-	  } else if (colours[DIR] == 1) {
-		if (colours[NUM_INC] == 1) {
-		  colours[DIR] = 0;
-		  colours[FGC_RED] = colours[FG1_RED];
-		  colours[FGC_GREEN] = colours[FG1_GREEN];
-		  colours[FGC_BLUE] = colours[FG1_BLUE];
-		} else {
-		  if (colours[FG2_RED] < colours[FG1_RED]) {
-		    if (colours[FG1_RED] - colours[FGC_RED] < colours[INC_RED]) {
-	          colours[FGC_RED] = colours[FG1_RED];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_RED] += colours[INC_RED];
-		    }
-          } else {
-	  	    if (colours[FGC_RED] - colours[FG1_RED] < colours[INC_RED]) {
-	          colours[FGC_RED] = colours[FG1_RED];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_RED] -= colours[INC_RED];
-		    }
-	  	  }
-	  	
-	  	  if (colours[FG2_GREEN] < colours[FG1_GREEN]) {
-		    if (colours[FG1_GREEN] - colours[FGC_GREEN] < colours[INC_GREEN]) {
-	          colours[FGC_GREEN] = colours[FG1_GREEN];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_GREEN] += colours[INC_GREEN];
-		    }
-          } else {
-	  	    if (colours[FGC_GREEN] - colours[FG1_GREEN] < colours[INC_GREEN]) {
-	          colours[FGC_GREEN] = colours[FG1_GREEN];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_GREEN] -= colours[INC_GREEN];
-		    }
-	  	  }
-	  	
-	  	  if (colours[FG2_BLUE] < colours[FG1_BLUE]) {
-		    if (colours[FG1_BLUE] - colours[FGC_BLUE] < colours[INC_BLUE]) {
-	          colours[FGC_BLUE] = colours[FG1_BLUE];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_BLUE] += colours[INC_BLUE];
-		    }
-          } else {
-	  	    if (colours[FGC_BLUE] - colours[FG1_BLUE] < colours[INC_BLUE]) {
-	          colours[FGC_BLUE] = colours[FG1_BLUE];
-	          colours[DIR] = 0;
-	        } else {
-			  colours[FGC_BLUE] -= colours[INC_BLUE];
-		    }
-	  	  }
-	    }
-	  }	 	  
-	}
+// Sets up the layers for a new group: the base from where the frame is
+// heading (which may have been set without layers, e.g. by a clip) and the
+// rest black.  Every LED is marked to be blended again.
+void reset_layers() {
+  memset(layer_rgb[1], 0, sizeof(layer_rgb) - sizeof(layer_rgb[0]));
+  for (unsigned int led = 0; led < NUM_LED; led++) {
+    for (byte lane = 0; lane < 3; lane++) {
+      layer_rgb[0][3*led + lane] = new_grayscale_values[LED_CHANNEL(led, lane)];
+    }
+    layer_dirty[led >> 3] |= _BV(led & 7);
   }
 }
 
-// Not my code; copied from Wikipedia page on XORShift algorithms
-// Maximum is exclusive
-// All this does is generate a random number between 0 and the maximum
-byte random_number(byte maximum) {
-  static uint32_t x = 123456789;
-  static uint32_t y = 362436069;
-  static uint32_t z = 521288629;
-  static uint32_t w = 88675123;
-  uint32_t t;
+// a*b/255, rounded
+byte mul255(byte a, byte b) {
+  unsigned int t = (unsigned int)a * b + 128;
+  
+  return (t + (t >> 8)) >> 8;
+}
 
-  t = x ^ (x << 11);
-  x = y; y = z; z = w;
-  w = w ^ (w >> 19) ^ (t ^ (t >> 8));
-  return w%maximum;
+// One channel of a layer (above) over what's below it
+byte blend_channel(byte below, byte above, byte mode, byte opacity) {
+  switch (mode) {
+    case BLEND_REPLACE: return above;
+    case BLEND_ADD: above = below > 255 - above ? 255 : below + above; break;
+    case BLEND_MAX: above = max(below, above); break;
+    case BLEND_MULTIPLY: above = mul255(below, above); break;
+  }
+  if (above > below) {
+    return below + mul255(above - below, opacity);
+  }
+  return below - mul255(below - above, opacity);
 }
 
+// Blends the layers of every LED marked in layer_dirty into the frame
+void blend_layers() {
+  byte out[3];
+  unsigned int led;
+  
+  if (effects[0].step.effect == EFFECT_PLAYBACK) {
+    memset(layer_dirty, 0, sizeof(layer_dirty));
+    return;
+  }
+  for (unsigned int group = 0; group < sizeof(layer_dirty); group++) {
+    // Skip 8 LEDs at a time while nothing has changed
+    if (layer_dirty[group] == 0) {
+      continue;
+    }
+    for (byte bit = 0; bit < 8; bit++) {
+      if (!(layer_dirty[group] & _BV(bit))) {
+        continue;
+      }
+      led = 8*group + bit;
+      memcpy(out, &layer_rgb[0][3*led], 3);
+      for (byte e = 1; e < effects_running; e++) {
+        const struct effect *fx = &effects[e];
+        const byte *rgb = &layer_rgb[e][3*led];
+        
+        // Also false for LEDs before first, as the sum wraps round
+        if (led - fx->first < fx->count) {
+          for (byte lane = 0; lane < 3; lane++) {
+            out[lane] = blend_channel(out[lane], rgb[lane], fx->step.blend, fx->step.opacity);
+          }
+        }
+      }
+      led_set_new(led, out[0], out[1], out[2], layer_fade[led]);
+    }
+    layer_dirty[group] = 0;
+  }
+}
+#endif
 
 // ============= Animation Functions ===================================
 
@@ -1161,128 +2911,140 @@ byte random_number(byte maximum) {
  * fade_in: This sets how quickly the LEDs fade in.  Refer to the
  * 			'perform_fades' function's comments for more info
  * fade_out: This sets how quickly the LEDs fade out.
+ * 
+ * They also all take the effect instance they're running as (see Effect
+ * Instances), which keeps everything they need from one frame to the next,
+ * and they only touch its LEDs.  Within an effect the LEDs are numbered
+ * from 0 to fx->count - 1, and LED n is LED fx->first + n of the chain.
  */
 
 
+// Switch all the LEDs off, at the speed the last effect faded them out
+void all_off(struct effect *fx) {
+  effect_set_all(fx, 0, 0, 0, fx->off_speed);
+}
+
 // Switch all the LEDs onto the current foreground colour.
-void all_on(byte fade_in, byte fade_out) {
-  led_set_all(colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-  auto_advance_counter++;
-  off_speed = fade_out;
+void all_on(struct effect *fx, byte fade_in, byte fade_out) {
+  byte *colours = fx->colours;
+  
+  effect_set_all(fx, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+  count_frame(fx);
+  fx->off_speed = fade_out;
 }
 
 // Fades all LEDs on and off repeatedly
-void fades(byte period, byte fade_in, byte fade_out) {
+void fades(struct effect *fx, byte period, byte fade_in, byte fade_out) {
+  byte *colours = fx->colours;
   
-  if (anim_count == 0) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+  if (fx->anim_count == 0) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
   }
   
-  if (anim_count == 1) {
-	led_set_all(colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+  if (fx->anim_count == 1) {
+	effect_set_all(fx, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
   }
-  else if (anim_count == period) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
-	perform_spectrum_shifts();
+  else if (fx->anim_count == period) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+	perform_spectrum_shifts(colours, &fx->random);
   }
   
-  if (anim_count >= 2 * period) {
-	anim_count = 0;
+  if (fx->anim_count >= 2 * period) {
+	fx->anim_count = 0;
   }
-  anim_count++;
-  auto_advance_counter++;
-  off_speed = fade_out;
+  fx->anim_count++;
+  count_frame(fx);
+  fx->off_speed = fade_out;
 }
 
 // This cannot be set with a fade_out of 0 and with the 'wait' flag set.
 // It would look odd anyway.
 // This is arguably messier than perform_fades()... :(
 // If the wait flag is set (to 1) then only 1 LED can be on at a time
-void runners(byte period, int8_t dir, byte fade_in, byte fade_out, 
+void runners(struct effect *fx, byte period, int8_t dir, byte fade_in, byte fade_out, 
 	byte wait, byte bounce) {
+  byte *colours = fx->colours;
   
-  static int8_t led_num;
-  static int8_t reversed;
-  
-  if (anim_count == 0) {
-	reversed = 1;
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+  if (fx->anim_count == 0) {
+	fx->s.runners.led_num = 0;
+	fx->s.runners.reversed = 1;
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
   }
   
-  if (anim_count%period == 0) {
-	if (led_num == NUM_LED) {
+  if (fx->anim_count%period == 0) {
+	if (fx->s.runners.led_num == fx->count) {
 	  if (wait == 1) {
-		if (dir*reversed == 1) {
-	      if (get_led_red(NUM_LED - 1) == colours[BG_RED] 
-	        && get_led_green(NUM_LED - 1) == colours[BG_GREEN]  
-	        && get_led_blue(NUM_LED - 1) == colours[BG_BLUE] ) {
+		if (dir*fx->s.runners.reversed == 1) {
+	      if (get_led_red(fx->first + fx->count - 1) == colours[BG_RED] 
+	        && get_led_green(fx->first + fx->count - 1) == colours[BG_GREEN]  
+	        && get_led_blue(fx->first + fx->count - 1) == colours[BG_BLUE] ) {
 			
-			led_num = 0;
+			fx->s.runners.led_num = 0;
 			if (bounce == 1) {
-			  reversed = -1;
+			  fx->s.runners.reversed = -1;
 			  if (wait == 0) {
-				led_num = 1;
+				fx->s.runners.led_num = 1;
 			  }
 			}
 	      }
 	    } else {
-		  if (get_led_red(0) == 0 
-	        && get_led_green(0) == 0 
-	        && get_led_blue(0) == 0) {
+		  if (get_led_red(fx->first) == 0 
+	        && get_led_green(fx->first) == 0 
+	        && get_led_blue(fx->first) == 0) {
 		  
-		    led_num = 0;
+		    fx->s.runners.led_num = 0;
 		    if (bounce == 1) {
-			  reversed = 1;
+			  fx->s.runners.reversed = 1;
 			  if (wait == 0) {
-				led_num = 1;
+				fx->s.runners.led_num = 1;
 			  }
 			}
 	      }
 		}
       } else {
-		led_num = 0;
+		fx->s.runners.led_num = 0;
 		if (bounce == 1) {
-		  reversed *= -1;
+		  fx->s.runners.reversed *= -1;
 		  if (wait == 0) {
-		    led_num = 1;
+		    fx->s.runners.led_num = 1;
 		  }
 		}
 	  }
 	  if (colours[FADE_STYLE] == 2 || colours[FADE_STYLE] == 4) {
-		perform_spectrum_shifts();
+		perform_spectrum_shifts(colours, &fx->random);
 	  }
 	}
-	if (led_num != NUM_LED) {
-	  if (dir*reversed == -1) {
-	    led_set_new(NUM_LED - led_num - 1, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+	if (fx->s.runners.led_num != fx->count) {
+	  if (dir*fx->s.runners.reversed == -1) {
+	    led_set_new(fx->first + fx->count - fx->s.runners.led_num - 1, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
 	  } else {
-		led_set_new(led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+		led_set_new(fx->first + fx->s.runners.led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
 	  }
 	  
 	  if (colours[FADE_STYLE] == 1 || colours[FADE_STYLE] == 3) {
-		perform_spectrum_shifts();
+		perform_spectrum_shifts(colours, &fx->random);
 	  }
 	  
-	  led_num++;
+	  fx->s.runners.led_num++;
 	}	
   }
-  for (loop_var = 0; loop_var < NUM_LED; loop_var++) {
-    if (test_not_fading(loop_var)) {
+  for (unsigned int led = 0; led < fx->count; led++) {
+    if (test_not_fading(fx->first + led)) {
 	  if (fade_out == 0) {
-	    if (dir*reversed == -1 && loop_var != NUM_LED - led_num) {
-		  led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
-	    } else if (dir*reversed == 1 && loop_var != led_num - 1) {
-		  led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+	    if (dir*fx->s.runners.reversed == -1 && led != fx->count - fx->s.runners.led_num) {
+		  led_set_new(fx->first + led, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+	    } else if (dir*fx->s.runners.reversed == 1 && led != fx->s.runners.led_num - 1) {
+		  led_set_new(fx->first + led, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
 	    }
       } else {
-		led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+		led_set_new(fx->first + led, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
 	  }
     }
   }
   
-  anim_count++;
-  auto_advance_counter++;
-  off_speed = fade_out;
+  fx->anim_count++;
+  count_frame(fx);
+  fx->off_speed = fade_out;
 }
 
 // This does a coundown effect.
@@ -1297,50 +3059,40 @@ void runners(byte period, int8_t dir, byte fade_in, byte fade_out,
 // 
 // If swap_state_on_loop, loop_cycle and switch_dir_on_loop are set, then you can get
 // A sort of bouncing effect.
-void counting(byte min_period, int8_t dir, byte fade_up, byte fade_out, 
+void counting(struct effect *fx, byte min_period, int8_t dir, byte fade_up, byte fade_out, 
     byte start_state, byte wait, byte loop_cycle, byte switch_dir_on_loop, 
     byte swap_state_on_loop) {
-	
-  static int8_t led_num;
-  static int8_t reversed;
-  static byte continu;
-  static byte fade_in;
-  static byte state;
-
-  if (anim_count == 0) {
-	reversed = 1;
- 	led_num = 0;
- 	fade_in = fade_up;
- 	state = start_state;
-	if (state == 1) {
-	  led_set_all(colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-	} else if (state == 0) {
-	  led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+  byte *colours = fx->colours;
+  byte continu;
+
+  if (fx->anim_count == 0) {
+	fx->s.counting.reversed = 1;
+ 	fx->s.counting.led_num = 0;
+ 	fx->s.counting.fade_in = fade_up;
+ 	fx->s.counting.state = start_state;
+	if (fx->s.counting.state == 1) {
+	  effect_set_all(fx, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fx->s.counting.fade_in);
+	} else if (fx->s.counting.state == 0) {
+	  effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fx->s.counting.fade_in);
 	}
   }    
 
-  if (led_num <= NUM_LED) {  
+  if (fx->s.counting.led_num < fx->count) {
     
     continu = 0;
     
     // If wait flag is set, test for previous LED having finished fading.    
-    if (led_num == 0) {
-	  byte sum = 0;
-    
-	  for (loop_var = 0; loop_var < NUM_LED; loop_var++) {
-		sum += test_not_fading(loop_var);
-	  }
-	  
-	  if (sum == NUM_LED) {
+    if (fx->s.counting.led_num == 0) {
+	  if (!effect_fading(fx)) {
 		continu = 1;
 	  }
-    } else if (anim_count >= 1 && wait == 1) {
-      if (dir * reversed == 1) {
-	    if (test_not_fading(led_num - 1)) {
+    } else if (fx->anim_count >= 1 && wait == 1) {
+      if (dir * fx->s.counting.reversed == 1) {
+	    if (test_not_fading(fx->first + fx->s.counting.led_num - 1)) {
 	      continu = 1;
 	    }
-      } else if (dir * reversed == -1) {
-	    if (test_not_fading(NUM_LED - led_num + 1)) {  
+      } else if (dir * fx->s.counting.reversed == -1) {
+	    if (test_not_fading(fx->first + fx->count - fx->s.counting.led_num)) {  
 	      continu = 1;
 	    }
       }
@@ -1348,206 +3100,1209 @@ void counting(byte min_period, int8_t dir, byte fade_up, byte fade_out,
 	  continu = 1;
 	}  
   
-    if (anim_count >= min_period && continu == 1) {
-	  if (dir * reversed == 1) {
-	    if (state == 1) {
-		  led_set_new(led_num, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+    if (fx->anim_count >= min_period && continu == 1) {
+	  if (dir * fx->s.counting.reversed == 1) {
+	    if (fx->s.counting.state == 1) {
+		  led_set_new(fx->first + fx->s.counting.led_num, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
 	    } else {
-		  led_set_new(led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+		  led_set_new(fx->first + fx->s.counting.led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fx->s.counting.fade_in);
 	    }
 	  } else {
-	    if (state == 1) {
-		  led_set_new(NUM_LED - led_num, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+	    if (fx->s.counting.state == 1) {
+		  led_set_new(fx->first + fx->count - fx->s.counting.led_num - 1, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
 	    } else {
-		  led_set_new(NUM_LED - led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+		  led_set_new(fx->first + fx->count - fx->s.counting.led_num - 1, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fx->s.counting.fade_in);
 	    }
 	  }
-	  anim_count = 0;
-      led_num++;
+	  fx->anim_count = 0;
+      fx->s.counting.led_num++;
       if (colours[FADE_STYLE] == 1 || colours[FADE_STYLE] == 3) {
-		perform_spectrum_shifts();
+		perform_spectrum_shifts(colours, &fx->random);
 	  }
     }
-    anim_count++;
-    auto_advance_counter++;
+    fx->anim_count++;
+    count_frame(fx);
   } else if (loop_cycle == 1) {
 	  
 	if ((colours[FADE_STYLE] == 2 || colours[FADE_STYLE] == 4) && swap_state_on_loop != 1) {
-	  perform_spectrum_shifts();
+	  perform_spectrum_shifts(colours, &fx->random);
 	}
 	
 	if (switch_dir_on_loop == 1) {
-	  reversed *= -1;
+	  fx->s.counting.reversed *= -1;
     }
     
 	if (swap_state_on_loop == 1) {
-	  if (state == 0) {
-		state = 1;
+	  if (fx->s.counting.state == 0) {
+		fx->s.counting.state = 1;
 	  } else {
-		state = 0;
+		fx->s.counting.state = 0;
 		if (colours[FADE_STYLE] == 2 || colours[FADE_STYLE] == 4) {
-	      perform_spectrum_shifts();
+	      perform_spectrum_shifts(colours, &fx->random);
 	    }
 	  }
     } else {
-	  if (state == 1) {
-	    led_set_all(colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-	  } else if (state == 0) {
-	    led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+	  if (fx->s.counting.state == 1) {
+	    effect_set_all(fx, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fx->s.counting.fade_in);
+	  } else if (fx->s.counting.state == 0) {
+	    effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fx->s.counting.fade_in);
 	  }
 	}
     
- 	led_num = 0;
+ 	fx->s.counting.led_num = 0;
   }
-off_speed = fade_out;
+fx->off_speed = fade_out;
 }
 
 // This switches on LEDs at random.
-// number_on is the number of LEDs switched on per cycle.
+// number_on is the number of LEDs switched on per cycle, all different.
 // Setting the wait flag (to 1) means only 'number_on' LEDs can be on at once.
-void raindrops(byte min_period, byte number_on, byte fade_in, byte fade_out, byte wait) {
-  static int8_t led_num;
-  static int8_t continu;
-  
-  if (anim_count == 0) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
-	continu = 0;
-	for (loop_var = 0; loop_var < number_on; loop_var++) {
-	  led_num = random_number(NUM_LED);
-	  led_set_new(led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-    }
+void raindrops(struct effect *fx, byte min_period, byte number_on, byte fade_in, byte fade_out, byte wait) {
+  byte *colours = fx->colours;
+  
+  if (fx->anim_count == 0) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+	fx->s.raindrops.continu = 0;
+	raindrops_fall(fx, number_on, fade_in);
   }
   
-  if (anim_count >= min_period) {
-	if (test_not_fading(led_num)) {
-	  led_set_new(led_num, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+  if (fx->anim_count >= min_period) {
+	if (test_not_fading(fx->first + fx->s.raindrops.led_num)) {
+	  led_set_new(fx->first + fx->s.raindrops.led_num, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
 	  
-	  if (wait == 0 || continu == 1) {
-		for (loop_var = 0; loop_var < number_on; loop_var++) {
-	      led_num = random_number(NUM_LED);
-	      led_set_new(led_num, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-        }
-                perform_spectrum_shifts();
-		anim_count = 0;
-		continu = 0;
+	  if (wait == 0 || fx->s.raindrops.continu == 1) {
+		raindrops_fall(fx, number_on, fade_in);
+                perform_spectrum_shifts(colours, &fx->random);
+		fx->anim_count = 0;
+		fx->s.raindrops.continu = 0;
 	  } else if (wait == 1) {			  
-		continu = 1;
+		fx->s.raindrops.continu = 1;
 	  }
 	}
   }
-  anim_count++;
-  auto_advance_counter++;
-  off_speed = fade_out;
+  fx->anim_count++;
+  count_frame(fx);
+  fx->off_speed = fade_out;
+}
+
+// Switches number_on different LEDs on at random, and keeps the last one
+// in led_num
+void raindrops_fall(struct effect *fx, byte number_on, byte fade_in) {
+  byte *colours = fx->colours;
+  // One bit per LED of the effect, set for the ones picked
+  byte picked[(NUM_LED + 7) / 8];
+  
+  fx->s.raindrops.led_num = random_pick(&fx->random, picked, number_on, fx->count);
+  for (unsigned int led = 0; led < fx->count; led++) {
+    if (picked[led >> 3] & _BV(led & 7)) {
+      led_set_new(fx->first + led, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+    }
+  }
 }
 
 // pattern_i is a binary value where 1 represents an LED on and a 0 an LED off.
 // Pattern invert then simply swaps LEDs that are on to LEDs that are off and vice versa
-void pattern_invert(uint16_t pattern_i, byte period, byte fade_in, byte fade_out) {
-  static uint16_t pattern;
+// The patterns of pattern_invert, pattern_shift and binary_counter are
+// PATTERN_BITS wide: bit n is LED n of the effect's range.  Ranges longer
+// than that have the pattern over again every PATTERN_BITS LEDs.
+#define PATTERN_BITS	16
+
+// How many bits of its pattern fx uses
+byte pattern_width(struct effect *fx) {
+  return fx->count < PATTERN_BITS ? fx->count : PATTERN_BITS;
+}
+
+// The bits of fx's pattern that it uses
+uint16_t pattern_mask(struct effect *fx) {
+  return (1UL << pattern_width(fx)) - 1;
+}
+
+// Sets fx's LEDs to the foreground colour where its pattern has a 1 and the
+// background where it has a 0
+void show_pattern(struct effect *fx, byte fade_in, byte fade_out) {
+  byte *colours = fx->colours;
+  byte width = pattern_width(fx);
+  byte bit = 0;
+  
+  for (unsigned int led = 0; led < fx->count; led++) {
+    if (fx->s.pattern.pattern & (1UL << bit)) {
+      led_set_new(fx->first + led, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
+    } else {
+      led_set_new(fx->first + led, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
+    }
+    if (++bit == width) {
+      bit = 0;
+    }
+  }
+}
+
+void pattern_invert(struct effect *fx, uint16_t pattern_i, byte period, byte fade_in, byte fade_out) {
+  byte *colours = fx->colours;
   
-  if (anim_count == 0) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
-	pattern  = pattern_i;
+  if (fx->anim_count == 0) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+	fx->s.pattern.pattern  = pattern_i;
   }
   
-  if (anim_count >= period) {
-    for (loop_var = 0; loop_var < NUM_LED; loop_var++) {
-	  if (pattern & _BV(loop_var)) {
-	    led_set_new(loop_var, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-	  } else {
-	    led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
-	  }
-    }
-    anim_count = 0;
-    pattern = ~pattern;
+  if (fx->anim_count >= period) {
+    show_pattern(fx, fade_in, fade_out);
+    fx->anim_count = 0;
+    fx->s.pattern.pattern = ~fx->s.pattern.pattern;
   }
-  anim_count++;
-  auto_advance_counter++;
-  perform_spectrum_shifts();
-  off_speed = fade_out;
+  fx->anim_count++;
+  count_frame(fx);
+  perform_spectrum_shifts(colours, &fx->random);
+  fx->off_speed = fade_out;
 }
 
 // Pattern shift is like pattern_invert, but instead with this function,
 // the pattern is shifted along by one.
 // If the bounce flag is set (to 1), when the pattern reaches the first or last LED,
 // the direction it shifts will be reversed.
-void pattern_shift(uint16_t pattern_i, byte period, byte fade_in, byte fade_out, int8_t dir_i, byte bounce) {
-  static uint16_t pattern;
-  static int8_t dir;
+void pattern_shift(struct effect *fx, uint16_t pattern_i, byte period, byte fade_in, byte fade_out, int8_t dir_i, byte bounce) {
+  byte *colours = fx->colours;
+  byte width = pattern_width(fx);
   
-  if (anim_count == 0) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
-	pattern  = pattern_i;
-	dir = dir_i;
+  if (fx->anim_count == 0) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+	fx->s.pattern.pattern  = pattern_i & pattern_mask(fx);
+	fx->s.pattern.dir = dir_i;
   }
   
-  if (anim_count >= period) {
-    for (loop_var = 0; loop_var < NUM_LED; loop_var++) {
-	  if (pattern & _BV(loop_var)) {
-	    led_set_new(loop_var, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-	  } else {
-	    led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
-	  }
-    }
-    anim_count = 0;
+  if (fx->anim_count >= period) {
+    show_pattern(fx, fade_in, fade_out);
+    fx->anim_count = 0;
     
     if (bounce == 1) {
-	  if (dir == 1) {
-		if (pattern & _BV(NUM_LED - 1)) {
-		  dir = -1;
+	  if (fx->s.pattern.dir == 1) {
+		if (fx->s.pattern.pattern & (1UL << (width - 1))) {
+		  fx->s.pattern.dir = -1;
 		}
-	  } else if (dir == -1) {
-		if (pattern & 1) {
-		  dir = 1;
+	  } else if (fx->s.pattern.dir == -1) {
+		if (fx->s.pattern.pattern & 1) {
+		  fx->s.pattern.dir = 1;
 		}
 	  }
 	}
     
+    // Round within the bits in use, so nothing from past them comes back
     byte new_bit = 0;
-    if (dir == 1) {
-	  new_bit = (pattern >> (NUM_LED - 1)) & 1;
-	  pattern <<= 1;
-	  pattern |= new_bit;
+    if (fx->s.pattern.dir == 1) {
+	  new_bit = (fx->s.pattern.pattern >> (width - 1)) & 1;
+	  fx->s.pattern.pattern <<= 1;
+	  fx->s.pattern.pattern |= new_bit;
 	} else {
-	  new_bit = pattern & 1;
-	  pattern >>= 1;
-	  pattern |= new_bit << (NUM_LED - 1);
+	  new_bit = fx->s.pattern.pattern & 1;
+	  fx->s.pattern.pattern >>= 1;
+	  fx->s.pattern.pattern |= (uint16_t)(new_bit << (width - 1));
 	}
+	fx->s.pattern.pattern &= pattern_mask(fx);
   }
-  anim_count++;
-  perform_spectrum_shifts();
-  auto_advance_counter++;
-  off_speed = fade_out;
+  fx->anim_count++;
+  perform_spectrum_shifts(colours, &fx->random);
+  count_frame(fx);
+  fx->off_speed = fade_out;
 }
 
 // I just did this for fun; it doesn't look very good.
-void binary_counter(byte period, byte fade_in, byte fade_out) {
-  static uint16_t pattern;
-  static int8_t dir;
+void binary_counter(struct effect *fx, byte period, byte fade_in, byte fade_out) {
+  byte *colours = fx->colours;
   
-  if (anim_count == 0) {
-	led_set_all(colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
-	dir = 1;
+  if (fx->anim_count == 0) {
+	effect_set_all(fx, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_in);
+	fx->s.pattern.pattern = 0;
+	fx->s.pattern.dir = 1;
   }
   
-  if (anim_count >= period) {
-    for (loop_var = 0; loop_var < NUM_LED; loop_var++) {
-	  if (pattern & _BV(loop_var)) {
-	    led_set_new(loop_var, colours[FGC_RED], colours[FGC_GREEN], colours[FGC_BLUE], fade_in);
-	  } else {
-	    led_set_new(loop_var, colours[BG_RED], colours[BG_GREEN], colours[BG_BLUE], fade_out);
-	  }
-    }
-    anim_count = 0;
+  if (fx->anim_count >= period) {
+    show_pattern(fx, fade_in, fade_out);
+    fx->anim_count = 0;
     
-    pattern += dir;
+    fx->s.pattern.pattern += fx->s.pattern.dir;
     
-    if (pattern >= (1 << NUM_LED) - 1 || pattern <= 0) {
-	  dir *= -1;
+    if (fx->s.pattern.pattern >= pattern_mask(fx) || fx->s.pattern.pattern == 0) {
+	  fx->s.pattern.dir *= -1;
 	}
   }
-  anim_count++;
-  auto_advance_counter++;
-  off_speed = fade_out;
+  fx->anim_count++;
+  count_frame(fx);
+  fx->off_speed = fade_out;
+}
+
+
+// Plays clip number clip (see Clips) over and over, a frame every
+// FRAME_MS.  Fades are stopped while it plays, as the clip has them
+// already worked out.  A clip is of every channel, so it plays over the
+// whole chain whatever LEDs the step is given.
+void playback(struct effect *fx, byte clip) {
+  if (fx->anim_count == 0) {
+    fx->s.playback.start = (const byte *)pgm_read_ptr(&CLIPS[clip]);
+    fx->s.playback.frames_left = 0;
+    fx->s.playback.next_ms = frame_ms;
+    stop_fades();
+    fx->anim_count = 1;
+  }
+  
+  // Every frame that's due has to be played, as each one only has the
+  // channels that changed
+  while ((int)(frame_ms - fx->s.playback.next_ms) >= 0) {
+    if (fx->s.playback.frames_left == 0) {
+      fx->s.playback.frames_left = pgm_read_word(fx->s.playback.start);
+      fx->s.playback.frame = fx->s.playback.start + 2;
+    }
+    fx->s.playback.frame = play_clip_frame(fx->s.playback.frame);
+    fx->s.playback.frames_left--;
+    fx->s.playback.next_ms += FRAME_MS;
+  }
+  count_frame(fx);
+}
+
+// Sets the channels from the clip frame at frame, and returns where the
+// next frame starts.  A clip recorded for a longer chain only sets the
+// channels there are on the chips; the rest of each frame is skipped over.
+const byte *play_clip_frame(const byte *frame) {
+  unsigned int channel = 0;
+  byte count;
+  byte set;
+  byte val;
+  
+  for (;;) {
+    channel += pgm_read_byte(frame++);
+    count = pgm_read_byte(frame++);
+    if (count == 0) {
+      return frame;
+    }
+    set = count;
+    if (channel + count > 16*NUM_TLC) {
+      set = channel < 16*NUM_TLC ? 16*NUM_TLC - channel : 0;
+    }
+    for (byte n = 0; n < set; n++) {
+      val = pgm_read_byte(frame++);
+      new_grayscale_values[channel] = val;
+      channel_set(channel++, val);
+    }
+    // Whatever's past the end is stepped over
+    frame += count - set;
+    channel += count - set;
+  }
+}
+
+// ============= Benchmarks ============================================
+
+#if BENCHMARK
+/*
+ * Runs every effect, and then every cue in animate(), for BENCH_FRAMES
+ * frames each and prints how long each stage of a frame took.
+ * 
+ * Output is one CSV line per run, so it can be pasted straight into a
+ * spreadsheet or diffed against the last version:
+ * bench,<name>,<NUM_TLC>,<NUM_LED>,<frames>,<animate ns>,<fades ns>,<upload ns>,<fps>
+ * 
+ * Times are per frame.  Upload includes waiting for the frame to be fully
+ * shifted out, and fps is for animate + fades + upload with no delay.
+ * NUM_TLC and NUM_LED are fixed when compiling, so to see how things scale
+ * with chain size build and run it once per size.  `make -C host bench`
+ * does that on a PC for 2 to 64 TLCs, more than fit on the board (see the
+ * README).
+ * 
+ * Then a line for the show player:
+ * show,<source>,<steps>,<find_cue us>,<read_step us>,<player RAM>,<free RAM>
+ * where find_cue is the time to find the last cue (the slowest), read_step
+ * the time to read one step in, and the RAM figures are in bytes.
+ * 
+ * And last the most a frame can cost for the size of the chain, with every
+ * LED fading and every channel sent:
+ * chain,<NUM_TLC>,<GS_CHUNK_TLC>,<NUM_LED>,<fades ns>,<upload ns>,<ns per channel>
+ * Build it for a few sizes of chain: if the time per channel stays the same,
+ * the cost goes up in a straight line with the size.
+ * 
+ * With LAYERS, the cost of blending (see Layers) every LED with 1 to
+ * NUM_EFFECTS layers, one line each:
+ * layers,<layers>,<NUM_LED>,<blend ns>,<ns per LED>
+ * The difference from one line to the next is what each extra layer costs.
+ * 
+ * With PROFILE, what profiling adds to each frame (see Profiling):
+ * profile,<ns per frame>,<percent of FRAME_MS>
+ * 
+ * Then the RAM, in bytes, that the chain takes (see CHAIN_RAM):
+ * ram,<NUM_TLC>,<NUM_LED>,<LEAN_RAM>,<chain RAM>,<per TLC>,<free RAM>
+ */
+
+#define BENCH_EFFECTS	7
+// Cues 1 to BENCH_CUES of animate() are run after the effects
+#define BENCH_CUES		(CLIP_DEMO ? 28 : 26)
+
+// Calls one frame of effect number id with some typical parameters,
+// on every LED as effects[0]
+void bench_effect(byte id) {
+  struct effect *fx = &effects[0];
+  
+  switch (id) {
+    case 0: fades(fx, 20, 2, 2); break;
+    case 1: runners(fx, 7, 1, 25, 8, 0, 0); break;
+    case 2: counting(fx, 100, -1, 10, 2, 1, 1, 0, 0, 0); break;
+    case 3: raindrops(fx, 1, 1, 15, 5, 0); break;
+    case 4: pattern_invert(fx, 341, 30, 0, 0); break;
+    case 5: pattern_shift(fx, 448, 9, 0, 0, 1, 1); break;
+    case 6: binary_counter(fx, 10, 0, 0); break;
+  }
+}
+
+void bench_print_name(byte id) {
+  switch (id) {
+    case 0: Serial.print(F("fades")); break;
+    case 1: Serial.print(F("runners")); break;
+    case 2: Serial.print(F("counting")); break;
+    case 3: Serial.print(F("raindrops")); break;
+    case 4: Serial.print(F("pattern_invert")); break;
+    case 5: Serial.print(F("pattern_shift")); break;
+    case 6: Serial.print(F("binary_counter")); break;
+  }
+}
+
+// Prints total_us/frames in nanoseconds without overflowing
+void bench_print_ns(unsigned long total_us, unsigned int frames) {
+  Serial.print(',');
+  Serial.print((total_us / frames) * 1000 + (total_us % frames) * 1000 / frames);
+}
+
+// Runs one benchmark.  id < BENCH_EFFECTS is an effect, otherwise
+// it's cue number id - BENCH_EFFECTS + 1 of animate()
+void bench_run(byte id) {
+  unsigned long animate_us = 0;
+  unsigned long fades_us = 0;
+  unsigned long upload_us = 0;
+  unsigned long t0, t1, t2;
+  
+  // Start from black, with the effect at its beginning
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+  if (id >= BENCH_EFFECTS) {
+    cue = id - BENCH_EFFECTS + 1;
+  } else {
+    // The effects borrow effects[0], so the show has to load its step again
+    loaded_step = NO_STEP;
+    effects[0].first = 0;
+    effects[0].count = NUM_LED;
+    effects[0].random = random_mix(id);
+  }
+  
+  for (unsigned int frame = 0; frame < BENCH_FRAMES; frame++) {
+    frame_ms = millis();
+    t0 = micros();
+    // With PROFILE the stages are timed as loop() times them, so comparing
+    // the fps with PROFILE 0 and 1 gives what profiling costs
+    frame_start_us = t0;
+    if (id < BENCH_EFFECTS) {
+      if (effects[0].anim_count == 0) {
+        assign_colours(effects[0].colours, BLACK, BLUE, WHITE, 3, 255);
+      }
+      bench_effect(id);
+    } else {
+      animate();
+    }
+    PROFILE_STAGE(PROFILE_ANIMATE);
+    t1 = micros();
+    perform_fades();
+    PROFILE_STAGE(PROFILE_FADES);
+    t2 = micros();
+    write_gs_data();
+    PROFILE_STAGE(PROFILE_UPLOAD);
+    while (gs_pending || gs_shifting) IRQ_WAIT();
+#if PROFILE
+    profile_frame(micros() - t0);
+#endif
+    animate_us += t1 - t0;
+    fades_us += t2 - t1;
+    upload_us += micros() - t2;
+  }
+  
+  Serial.print(F("bench,"));
+  if (id < BENCH_EFFECTS) {
+    bench_print_name(id);
+  } else {
+    Serial.print(F("cue"));
+    Serial.print(cue);
+  }
+  Serial.print(',');
+  Serial.print(NUM_TLC);
+  Serial.print(',');
+  Serial.print(NUM_LED);
+  Serial.print(',');
+  Serial.print(BENCH_FRAMES);
+  bench_print_ns(animate_us, BENCH_FRAMES);
+  bench_print_ns(fades_us, BENCH_FRAMES);
+  bench_print_ns(upload_us, BENCH_FRAMES);
+  Serial.print(',');
+  Serial.println(BENCH_FRAMES * 1000000.0 / (animate_us + fades_us + upload_us));
+}
+
+void run_benchmarks() {
+  Serial.begin(115200);
+  Serial.println(F("bench,name,num_tlc,num_led,frames,animate_ns,fades_ns,upload_ns,fps"));
+  
+  // All the effects, then the cues
+  for (byte id = 0; id < BENCH_EFFECTS + BENCH_CUES; id++) {
+    bench_run(id);
+  }
+  bench_show();
+  bench_chain();
+#if LAYERS
+  for (byte layers = 1; layers <= NUM_EFFECTS; layers++) {
+    bench_layers(layers);
+  }
+#endif
+#if PROFILE
+  bench_profile();
+#endif
+  bench_ram();
+  
+  // Leave everything as the show expects to find it
+  led_set_all(0, 0, 0, 0);
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+  cue = 0;
+}
+
+#if PROFILE
+// Times just the profiling a frame gets in loop(): its three stages and the
+// frame as a whole
+void bench_profile() {
+  unsigned long t0 = micros();
+  unsigned long took;
+  
+  for (unsigned int frame = 0; frame < BENCH_FRAMES; frame++) {
+    PROFILE_STAGE(PROFILE_ANIMATE);
+    PROFILE_STAGE(PROFILE_FADES);
+    PROFILE_STAGE(PROFILE_UPLOAD);
+    profile_frame(frame);
+  }
+  took = micros() - t0;
+  
+  Serial.print(F("profile"));
+  bench_print_ns(took, BENCH_FRAMES);
+  Serial.print(',');
+  Serial.println(took / 10.0 / BENCH_FRAMES / FRAME_MS);
+}
+#endif
+
+void bench_show() {
+  struct cue_step step;
+  unsigned int cues = 0;
+  unsigned int first;
+  unsigned long find_us;
+  unsigned long t0;
+  
+  for (unsigned int n = 0; n < show_steps; n++) {
+    if (step_flags(n) & STEP_END) {
+      cues++;
+    }
+  }
+  t0 = micros();
+  first = find_cue(cues);
+  find_us = micros() - t0;
+  
+  // Read a different step each time, so nothing can be cached
+  t0 = micros();
+  for (unsigned int n = 0; n < BENCH_FRAMES; n++) {
+    read_step((first + n) % show_steps, &step);
+  }
+  t0 = micros() - t0;
+  
+  Serial.print(F("show,"));
+#if SHOW_SOURCE == SHOW_SD
+  Serial.print(show_on_sd ? F("sd") : F("flash"));
+#else
+  Serial.print(F("flash"));
+#endif
+  Serial.print(',');
+  Serial.print(show_steps);
+  Serial.print(',');
+  Serial.print(find_us);
+  Serial.print(',');
+  Serial.print((float)t0 / BENCH_FRAMES);
+  Serial.print(',');
+  Serial.print(sizeof(effects) + sizeof(loaded_step) + sizeof(loaded_cue)
+    + sizeof(cue_first_step) + sizeof(show_steps) + sizeof(step_advance)
+    + sizeof(step_group) + sizeof(effects_running));
+  Serial.print(',');
+  Serial.println(free_ram());
+}
+
+void bench_chain() {
+  unsigned long fades_us = 0;
+  unsigned long upload_us = 0;
+  unsigned long t0;
+  
+  for (unsigned int frame = 0; frame < BENCH_FRAMES; frame++) {
+    // Turn every LED round towards the other end of the spectrum, so they
+    // are all always fading
+    frame_ms = millis();
+    for (unsigned int led = 0; led < NUM_LED; led++) {
+      led_fade_to(led, frame & 1 ? 255 : 0, 128, frame & 1 ? 0 : 255, 1000);
+    }
+    t0 = micros();
+    perform_fades();
+    fades_us += micros() - t0;
+    
+    // Send every channel, whether it has changed or not
+    gs_dirty = 1;
+    t0 = micros();
+    write_gs_data();
+    while (gs_pending || gs_shifting) IRQ_WAIT();
+    upload_us += micros() - t0;
+  }
+  
+  Serial.print(F("chain,"));
+  Serial.print(NUM_TLC);
+  Serial.print(',');
+  Serial.print(GS_CHUNK_TLC);
+  Serial.print(',');
+  Serial.print(NUM_LED);
+  bench_print_ns(fades_us, BENCH_FRAMES);
+  bench_print_ns(upload_us, BENCH_FRAMES);
+  Serial.print(',');
+  Serial.println((fades_us + upload_us) * 1000.0 / BENCH_FRAMES / (16 * NUM_TLC));
+}
+
+#if LAYERS
+// Blends every LED with the given number of layers, the ones above the base
+// added in at half opacity (a blend and a mix for every channel)
+void bench_layers(byte layers) {
+  unsigned long blend_us = 0;
+  unsigned long t0;
+  
+  effects_running = layers;
+  for (byte e = 0; e < layers; e++) {
+    effects[e].step.effect = EFFECT_NONE;
+    effects[e].step.blend = BLEND_ADD;
+    effects[e].step.opacity = 128;
+    effects[e].first = 0;
+    effects[e].count = NUM_LED;
+  }
+  for (unsigned int frame = 0; frame < BENCH_FRAMES; frame++) {
+    frame_ms = millis();
+    // Change every LED in every layer, so they all have to be blended
+    for (byte e = 0; e < layers; e++) {
+      for (unsigned int led = 0; led < NUM_LED; led++) {
+        layer_set(e, led, frame & 1 ? 200 : 50, 100 + e, frame & 1 ? 50 : 200, 1);
+      }
+    }
+    t0 = micros();
+    blend_layers();
+    blend_us += micros() - t0;
+  }
+  // The show has to load its step again
+  loaded_step = NO_STEP;
+  effects_running = 0;
+  
+  Serial.print(F("layers,"));
+  Serial.print(layers);
+  Serial.print(',');
+  Serial.print(NUM_LED);
+  bench_print_ns(blend_us, BENCH_FRAMES);
+  Serial.print(',');
+  Serial.println(blend_us * 1000.0 / BENCH_FRAMES / NUM_LED);
+}
+#endif
+
+void bench_ram() {
+  Serial.print(F("ram,"));
+  Serial.print(NUM_TLC);
+  Serial.print(',');
+  Serial.print(NUM_LED);
+  Serial.print(',');
+  Serial.print(LEAN_RAM);
+  Serial.print(',');
+  Serial.print(CHAIN_RAM);
+  Serial.print(',');
+  Serial.print((float)CHAIN_RAM / NUM_TLC);
+  Serial.print(',');
+  Serial.println(free_ram());
+}
+
+#ifndef TLC_HAL_EXTERNAL
+// Bytes free between the heap and the stack
+int free_ram() {
+  extern int __heap_start;
+  extern int *__brkval;
+  int here;
+  
+  return (int)&here - (__brkval == 0 ? (int)&__heap_start : (int)__brkval);
+}
+#endif
+#endif
+
+// ============= Recording =============================================
+
+#if RECORD_CUE || defined(TLC_HAL_EXTERNAL)
+// Runs cue c for skip + frames frames and prints the last frames of them
+// as a clip.
+// The frames are run on a made up clock, FRAME_MS apart, so the clip
+// comes out the same however long the printing takes.
+void record_clip(int c, unsigned int skip, unsigned int frames) {
+  byte last[16*NUM_TLC];
+  
+  Serial.begin(115200);
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+  cue = c;
+  
+  Serial.print(F("// Cue "));
+  Serial.print(c);
+  Serial.print(F(", "));
+  Serial.print(frames);
+  Serial.println(F(" frames"));
+  Serial.println(F("const byte CLIP_DATA[] PROGMEM = {"));
+  Serial.print(F("  "));
+  record_byte(frames & 0xFF);
+  record_byte(frames >> 8);
+  Serial.println();
+  for (unsigned int frame = 0; frame < skip + frames; frame++) {
+    frame_ms = frame * FRAME_MS;
+    animate();
+    perform_fades();
+    write_gs_data();
+    if (frame >= skip) {
+      record_frame(last, frame == skip);
+    }
+  }
+  Serial.println(F("};"));
+  
+  // Leave everything as the show expects to find it
+  led_set_all(0, 0, 0, 0);
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+  cue = 0;
+}
+
+// Prints one clip frame: the runs of channels that differ from last (or
+// every channel, if all is set).  last is brought up to date.
+void record_frame(byte *last, byte all) {
+  unsigned int channel = 0;
+  unsigned int end;
+  byte skip;
+  
+  Serial.print(F("  "));
+  while (channel < 16*NUM_TLC) {
+    for (skip = 0; skip < 255 && channel < 16*NUM_TLC && !all
+        && grayscale_values[channel] == last[channel]; skip++) {
+      channel++;
+    }
+    if (channel == 16*NUM_TLC) {
+      break;
+    }
+    // The changed channels (or, if skip ran out, the next channel anyway)
+    end = channel + 1;
+    while (end < 16*NUM_TLC && end - channel < 255
+        && (all || grayscale_values[end] != last[end])) {
+      end++;
+    }
+    record_byte(skip);
+    record_byte(end - channel);
+    for (; channel < end; channel++) {
+      last[channel] = grayscale_values[channel];
+      record_byte(last[channel]);
+    }
+  }
+  record_byte(0);
+  record_byte(0);
+  Serial.println();
+}
+
+void record_byte(byte b) {
+  Serial.print(b);
+  Serial.print(F(", "));
+}
+#endif
+
+// ============= Preview ===============================================
+
+#if PREVIEW_CUES || defined(TLC_HAL_EXTERNAL)
+/*
+ * Shows can be watched without the rig: the preview plays the cues and
+ * sends what each LED gives out, every frame, as one image of raw 8 bit RGB
+ * (no header, no gaps), PREVIEW_WIDTH pixels wide and as many rows as it
+ * takes.  LED n is pixel n, counting along the rows, and any pixels left
+ * over at the end are black.  Lay the LEDs out to suit by choosing
+ * PREVIEW_WIDTH and, with FIXTURE_MAP, which LED is which.
+ * 
+ * The frames run on a made up clock, FRAME_MS apart, so they come out the
+ * same however long sending them takes, and much faster than the show
+ * would play: a frame only costs what animate() and perform_fades() take
+ * and 3 bytes an LED over serial.  Give RANDOM_SEED a seed for the same
+ * preview every time.
+ * 
+ * Each colour is what the TLC would do with it: its PWM value (see
+ * PWM_VALUE, without dithering), scaled down by its dot correction (see Dot
+ * Correction), and then turned back into the level that would give that
+ * much light at full current, so the picture comes out with the same
+ * brightness curve as the show was written for.
+ * 
+ * The board resets when the port is opened, so e.g. on Linux with 9 LEDs
+ * in a row and FRAME_MS of 40:
+ * stty -F /dev/ttyACM0 1000000 raw -hupcl
+ * ffmpeg -f rawvideo -pixel_format rgb24 -video_size 9x1 -framerate 25
+ *   -i /dev/ttyACM0 -vf scale=900:100:flags=neighbor preview.mp4
+ * and stop it once PREVIEW_CUES * PREVIEW_FRAMES frames are in.
+ * 
+ * host/render plays the show the same way on a PC and draws each frame as
+ * an image, with the LEDs wherever a layout file puts them.
+ */
+
+#define PREVIEW_HEIGHT	((NUM_LED + PREVIEW_WIDTH - 1) / PREVIEW_WIDTH)
+
+// Plays cues 1 to PREVIEW_CUES and sends every frame
+void preview_show() {
+  unsigned int clock = 0;
+  
+  Serial.begin(PREVIEW_BAUD);
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  for (int c = 1; c <= PREVIEW_CUES; c++) {
+    preview_cue(c);
+    for (unsigned int frame = 0; frame < PREVIEW_FRAMES; frame++) {
+      preview_step(clock);
+      clock += FRAME_MS;
+      preview_frame();
+    }
+  }
+  
+  // Leave everything as the show expects to find it
+  led_set_all(0, 0, 0, 0);
+  preview_cue(0);
+}
+
+// Starts cue c from its first step
+void preview_cue(int c) {
+  cue = c;
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+}
+
+// Runs the frame due at ms on the made up clock
+void preview_step(unsigned long ms) {
+  frame_ms = ms;
+  animate();
+  perform_fades();
+  write_gs_data();
+}
+
+// Sends one frame, a row at a time
+void preview_frame() {
+  const byte lanes[3] = {RED_L, GREEN_L, BLUE_L};
+  
+  for (unsigned int pixel = 0; pixel < PREVIEW_WIDTH * PREVIEW_HEIGHT; pixel++) {
+    for (byte colour = 0; colour < 3; colour++) {
+      Serial.write(pixel < NUM_LED ? preview_level(LED_CHANNEL(pixel, lanes[colour])) : 0);
+    }
+  }
+}
+
+// The level that would give as much light at full current as channel does
+// now, to the nearest
+byte preview_level(unsigned int channel) {
+  unsigned int light = (unsigned long)pwm_value(grayscale_values[channel]) * dc_value(channel) / 63;
+  byte low = 0;
+  byte high = 255;
+  byte mid;
+  
+  // The brightest level that isn't brighter than light...
+  while (low < high) {
+    mid = (low + high + 1) / 2;
+    if (pwm_value(mid) <= light) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  // ...or the next one up, if that's closer
+  if (low < 255 && pwm_value(low + 1) - light < light - pwm_value(low)) {
+    low++;
+  }
+  return low;
+}
+#endif
+
+// ============= Profiling =============================================
+
+#if PROFILE
+/*
+ * With PROFILE on, every frame loop() times animate(), perform_fades() and
+ * write_gs_data() (each from the end of the one before, animate() from the
+ * start of the frame) and the whole frame up to when it starts waiting,
+ * all with micros(), so to the nearest 4us.  The grayscale cycle interrupt
+ * times itself with Timer1, which counts system clock cycles from the end of
+ * each grayscale cycle: how late it got in and how long it took.  Only its
+ * worst case is kept by the interrupt itself; the rest of its figures come
+ * from its last run before each frame.
+ * micros() goes up in 4s, so every time is a multiple of 4us, a stage that
+ * takes less than 4us can read 0, and min and max can be 4us out either way;
+ * the totals (and so the means) even out over many frames.
+ * To see what profiling costs, build the benchmarks (BENCHMARK) with
+ * PROFILE 0 and then 1 and compare the fps, as they time their frames the
+ * way loop() does; with PROFILE 1 they also time the profiling on its own
+ * (the profile line).  `make -C host profile-cost` prints that line for a
+ * PC, which only shows it's small next to the rest of a frame there, not
+ * what it costs on the board.
+ * 
+ * Sending PROFILE_REQUEST over serial gets a profile_record back, a few
+ * bytes each frame so nothing ever waits on the serial port.  Everything
+ * but the frame and latch counts (which are totals since the board started)
+ * covers the time since the last record was asked for, and the stages
+ * aren't timed while it's being sent.
+ * 
+ * The record is exactly the struct below, little endian and without any
+ * padding (PROFILE_RECORD_BYTES).  It starts "TP", then the version and the
+ * size of the whole record, in case either changes.  host/profile decodes
+ * and prints it (see host/README.md).
+ * For each stage there's the number of times it ran, the total, minimum and
+ * maximum time, and a histogram: hist[0] counts times under 4 (i.e. those
+ * that read 0), hist[n] times from 2^(n+1) up to 2^(n+2) - 1, and the last
+ * every time over that.
+ * The mean is total/count, and frames per second (times 100) are worked
+ * out from the number of frames and end_ms - start_ms.
+ * Frames sent by write_gs_data() but not yet latched can be found from
+ * gs_frames_sent - gs_latches, and are at most 2 with SPI.
+ */
+
+#define PROFILE_VERSION	1
+#define PROFILE_BUCKETS	12
+#define PROFILE_STAGE_BYTES		(12 + 2*PROFILE_BUCKETS)
+#define PROFILE_RECORD_BYTES	(52 + PROFILE_STAGES*PROFILE_STAGE_BYTES)
+
+struct profile_stage {
+  uint32_t count;
+  uint32_t total;
+  uint16_t min;
+  uint16_t max;
+  uint16_t hist[PROFILE_BUCKETS];
+};
+
+struct profile_record {
+  char magic[2];
+  byte version;
+  byte size;
+  uint32_t start_ms;
+  uint32_t end_ms;
+  uint32_t frames_run;
+  uint32_t frame_overruns;
+  uint32_t frames_dropped;
+  uint32_t gs_frames_sent;
+  uint32_t gs_frames_skipped;
+  uint32_t gs_latches;
+  uint32_t gs_latches_dropped;
+  uint32_t gs_upload_stalls;
+  uint16_t fps_x100;
+  uint16_t isr_latency_max;
+  uint16_t isr_cycles_max;
+  uint16_t stages;
+  struct profile_stage stage[PROFILE_STAGES];
+} profile;
+
+static_assert(sizeof(profile) == PROFILE_RECORD_BYTES && PROFILE_RECORD_BYTES < 256,
+  "profile_record has padding in it, or is too big for its size byte");
+
+// When the last stage finished (micros())
+unsigned long profile_mark = 0;
+// What's left of the record to send, if it's being sent
+const byte *profile_next_byte;
+unsigned int profile_bytes_left = 0;
+
+// Times the stage that has just finished
+void profile_stage(byte stage) {
+  unsigned long now = micros();
+  
+  profile_add(stage, now - (stage == PROFILE_ANIMATE ? frame_start_us : profile_mark));
+  profile_mark = now;
+}
+
+// Called at the end of every frame with how long the frame took
+void profile_frame(unsigned long took) {
+  unsigned int isr_cycles;
+  
+  INTERRUPTS_OFF();
+  isr_cycles = isr_cycles_last;
+  INTERRUPTS_ON();
+  profile_add(PROFILE_FRAME, took);
+  profile_add(PROFILE_ISR, isr_cycles);
+}
+
+// Adds one time to a stage's figures
+void profile_add(byte stage, unsigned long took) {
+  struct profile_stage *s = &profile.stage[stage];
+  byte bucket = 0;
+  
+  if (profile_bytes_left) {
+    return;
+  }
+  if (took > 0xFFFF) {
+    took = 0xFFFF;
+  }
+  if (took < s->min) {
+    s->min = took;
+  }
+  if (took > s->max) {
+    s->max = took;
+  }
+  s->total += took;
+  s->count++;
+  for (took >>= 2; took && bucket < PROFILE_BUCKETS - 1; took >>= 1) {
+    bucket++;
+  }
+  if (s->hist[bucket] != 0xFFFF) {
+    s->hist[bucket]++;
+  }
+}
+
+// Carries on sending the record, if it's being sent, as much at a time as
+// will fit in the serial buffer.  Returns non-zero until it's all gone.
+byte profile_poll() {
+  unsigned int room;
+  
+  if (!profile_bytes_left) {
+    return 0;
+  }
+  room = Serial.availableForWrite();
+  if (room > profile_bytes_left) {
+    room = profile_bytes_left;
+  }
+  Serial.write(profile_next_byte, room);
+  profile_next_byte += room;
+  profile_bytes_left -= room;
+  if (!profile_bytes_left) {
+    profile_clear();
+  }
+  return 1;
+}
+
+// Fills in the rest of the record and starts it sending
+void profile_fill() {
+  unsigned long elapsed;
+  
+  profile.end_ms = millis();
+  profile.frames_run = frames_run;
+  profile.frame_overruns = frame_overruns;
+  profile.frames_dropped = frames_dropped;
+  profile.gs_frames_sent = gs_frames_sent;
+  profile.gs_frames_skipped = gs_frames_skipped;
+  profile.gs_latches_dropped = gs_latches_dropped;
+  profile.gs_upload_stalls = gs_upload_stalls;
+  elapsed = profile.end_ms - profile.start_ms;
+  profile.fps_x100 = elapsed ? profile.stage[PROFILE_FRAME].count * 100000.0 / elapsed : 0;
+  
+  INTERRUPTS_OFF();
+  profile.gs_latches = gs_latches;
+  profile.isr_latency_max = isr_latency_max;
+  profile.isr_cycles_max = isr_cycles_max;
+  isr_latency_max = 0;
+  isr_cycles_max = 0;
+  INTERRUPTS_ON();
+  
+  profile_next_byte = (const byte *)&profile;
+  profile_bytes_left = sizeof(profile);
+}
+
+// Starts the record afresh
+void profile_clear() {
+  memset(&profile, 0, sizeof(profile));
+  profile.magic[0] = 'T';
+  profile.magic[1] = 'P';
+  profile.version = PROFILE_VERSION;
+  profile.size = sizeof(profile);
+  profile.stages = PROFILE_STAGES;
+  for (byte stage = 0; stage < PROFILE_STAGES; stage++) {
+    profile.stage[stage].min = 0xFFFF;
+  }
+  profile.start_ms = millis();
+}
+#endif
+
+// ============= Dot Correction ========================================
+
+/*
+ * Each channel's dot correction (the share, 0 - 63 out of 63, of the current
+ * set by the chips' IREF resistor) comes from a table in EEPROM if there is
+ * one, so that LEDs from batches that don't match can be evened out.
+ * Otherwise each channel gets RED_CURRENT, GREEN_CURRENT or BLUE_CURRENT by
+ * the leg it drives.
+ * 
+ * The table is the chain's layout (see dc_layout()), so one saved for a
+ * different chain or wiring isn't used, then a byte for each channel in
+ * channel order.  It needs to fit in EEPROM (up to 63 chips on an Uno).
+ * host/dctable makes one from measured brightnesses, as DC_MEASURED does,
+ * to go straight into EEPROM.
+ * 
+ * With DC_SERIAL a new one can be sent over serial as the show runs:
+ * - DC_REQUEST, then the value for each channel, or
+ * - DC_MEASURED, then a target brightness, then each channel's brightness
+ *   (0 - 255) as measured with the dot correction it has now, e.g. with
+ *   a light meter and every channel in turn at the same level.  Each
+ *   channel's value is scaled by target/measured so they all come out at the
+ *   target; the dimmest channel's brightness is the one to aim for.
+ *   Channels measured at 0 are left as they are.
+ * Each byte is echoed back once it's being written to EEPROM, which takes a
+ * few milliseconds, and the sender must wait for the echo before sending the
+ * next.  Only one byte is taken a frame.  When the last is in, the chips are
+ * sent the new table, which stays in use from then on.
+ */
+
+#define DC_HEADER		2
+#define DC_TABLE_FITS	(DC_EEPROM + DC_HEADER + 16*NUM_TLC <= (SEED_IN_EEPROM ? SEED_EEPROM : EEPROM_SIZE))
+
+// Set when the table in EEPROM is for this chain
+byte dc_from_eeprom = 0;
+#if DC_SERIAL
+// The request a table is coming in for (0 if there isn't one), the target
+// brightness with DC_MEASURED (0 until it's in), and the channel the next
+// byte is for
+byte dc_receiving = 0;
+byte dc_target = 0;
+unsigned int dc_next = 0;
+#endif
+
+// A hash of what the table's channels are wired to: the number of chips,
+// how they're split into chains and, with FIXTURE_MAP, the map.  A table
+// saved for anything else has a different one (bar a 1 in 65536 chance).
+uint16_t dc_layout() {
+  uint16_t layout = 5381;
+  
+  layout = layout_add(layout, NUM_TLC);
+  layout = layout_add(layout, NUM_CHAINS);
+#if FIXTURE_MAP
+  for (unsigned int led = 0; led < NUM_LED; led++) {
+    layout = layout_add(layout, pgm_read_byte(&FIXTURES[led].legs));
+    for (byte lane = 0; lane < 3; lane++) {
+      layout = layout_add(layout, LED_CHANNEL(led, lane));
+    }
+  }
+#endif
+  return layout;
+}
+
+// One more value in a layout hash (djb2)
+uint16_t layout_add(uint16_t layout, uint16_t value) {
+  return (layout << 5) + layout + value;
+}
+
+// Checks for a table in EEPROM
+void load_dc() {
+  uint16_t layout = dc_layout();
+  
+  dc_from_eeprom = DC_TABLE_FITS && EEPROM_READ(DC_EEPROM) == (byte)layout
+    && EEPROM_READ(DC_EEPROM + 1) == layout >> 8;
+}
+
+// Marks the table in EEPROM as good for this chain, or as no good
+void dc_mark(byte good) {
+  uint16_t layout = dc_layout();
+  
+  EEPROM_WRITE(DC_EEPROM, good ? (byte)layout : (byte)~layout);
+  EEPROM_WRITE(DC_EEPROM + 1, layout >> 8);
+}
+
+// A channel's dot correction scaled by target/measured, to bring its
+// measured brightness to the target.  Measured at 0, it's left as it is.
+byte dc_scaled(byte dc, unsigned int target, unsigned int measured) {
+  if (measured) {
+    return min(((unsigned long)dc * target + measured / 2) / measured, 63);
+  }
+  return dc;
+}
+
+// The 6 bit dot correction value for a channel
+byte dc_value(unsigned int channel) {
+  byte lane;
+  
+  if (dc_from_eeprom) {
+    return EEPROM_READ(DC_EEPROM + DC_HEADER + channel) & 0x3F;
+  }
+  lane = channel_lane(channel);
+  if (lane == RED_L) {
+    return RED_CURRENT;
+  } else if (lane == GREEN_L) {
+    return GREEN_CURRENT;
+  }
+  return BLUE_CURRENT;
+}
+
+// Sends the dot correction to the chips while the show is running.
+// The dot correction goes in through the same shift register as the
+// grayscale data, so this waits for the last frame to be latched, and
+// nothing more can go in until it's done.  Meanwhile the outputs carry on
+// with the frame they have, and the new currents take over at once when
+// they're latched.
+void update_dc() {
+  while (gs_pending || gs_shifting || data_waiting) IRQ_WAIT();
+#if USE_SPI
+  SPI_STOP();
+#endif
+  write_dc_data();
+#if USE_SPI
+  init_spi();
+#endif
+}
+
+#if DC_SERIAL
+// Starts taking a table for request (DC_REQUEST or DC_MEASURED).  The one in
+// EEPROM is marked as no good until the new one is all in.
+void dc_receive(byte request) {
+  if (!DC_TABLE_FITS) {
+    return;
+  }
+  dc_mark(0);
+  dc_receiving = request;
+  dc_target = 0;
+  dc_next = 0;
 }
 
+// Takes the next byte of the table coming in, if there is one and EEPROM is
+// free.  Returns non-zero until the table is all in.
+byte dc_poll() {
+  byte in;
+  byte dc;
+  
+  if (!dc_receiving) {
+    return 0;
+  }
+  if (!EEPROM_READY()) {
+    return 1;
+  }
+  if (dc_next == 16*NUM_TLC) {
+    // All in: mark it as good and use it
+    dc_mark(1);
+    dc_from_eeprom = 1;
+    dc_receiving = 0;
+    update_dc();
+    return 0;
+  }
+  if (!Serial.available()) {
+    return 1;
+  }
+  in = Serial.read();
+  if (dc_receiving == DC_MEASURED && !dc_target) {
+    dc_target = max(in, 1);
+    Serial.write(in);
+    return 1;
+  }
+  if (dc_receiving == DC_REQUEST) {
+    dc = min(in, 63);
+  } else {
+    // Until it's all in, dc_value() still gives the old value
+    dc = dc_scaled(dc_value(dc_next), dc_target, in);
+  }
+  EEPROM_WRITE(DC_EEPROM + DC_HEADER + dc_next, dc);
+  dc_next++;
+  Serial.write(in);
+  return 1;
+}
+#endif
@@ -0,0 +1,19 @@
+/*
+ * bench.cpp
+ *
+ * The sketch's own benchmarks (BENCHMARK, see Benchmarks in the sketch),
+ * run off the PC's clock, with their CSV printed as it comes.  The times
+ * are the PC's, not the board's, but how they go up with the length of the
+ * chain is the same sums.  `make bench` builds it for 2 to 64 chips.
+ */
+
+#include "sketch.inc"
+
+int main() {
+  host_real_clock = true;
+  host_serial_echo = true;
+  tlc_model_begin(NUM_CHAINS, CHAIN_TLC);
+  // setup() runs them
+  setup();
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * check.h
+ *
+ * Just enough for the tests: CHECK() reports what failed and where, and
+ * check_done() gives main() its exit code.  Included after the sketch.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+static unsigned long checks_failed = 0;
+
+#define CHECK(cond, ...)	do { \
+  if (!(cond)) { \
+    checks_failed++; \
+    fprintf(stderr, "%s:%d: %s failed: ", __FILE__, __LINE__, #cond); \
+    fprintf(stderr, __VA_ARGS__); \
+    fputc('\n', stderr); \
+  } \
+} while (0)
+
+// Stops reporting after the first few failures of a loop
+#define CHECK_QUIET()		(checks_failed > 20)
+
+inline int check_done(const char *name) {
+  if (checks_failed) {
+    fprintf(stderr, "%s: %lu checks failed\n", name, checks_failed);
+    return 1;
+  }
+  printf("%s: ok\n", name);
+  return 0;
+}
+
+// Starts the model of the chain and runs setup(), as the board does when
+// it's switched on
+inline void host_power_on() {
+  tlc_model_begin(NUM_CHAINS, CHAIN_TLC);
+  setup();
+}
+
+// Waits until the frame write_gs_data() last sent is in the chips
+inline void host_wait_latched() {
+  while (gs_pending || gs_shifting || data_waiting) {
+    IRQ_WAIT();
+  }
+}
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * dctable.cpp
+ *
+ * Works out a dot correction table (see Dot Correction in the sketch) from
+ * each channel's measured brightness, as DC_MEASURED does on the board, and
+ * writes it out as an EEPROM image to program straight in:
+ *
+ *   dctable MEASURED.txt DC.EEP [TARGET [OLD.EEP]]
+ *
+ * MEASURED.txt has a brightness for every channel of the chain in channel
+ * order, as numbers separated by spaces or new lines (# starts a comment),
+ * each measured the same way with every channel at the same level.  They
+ * can be in any units, e.g. lux.  TARGET is the brightness to bring them
+ * all to, the dimmest if left out.  The brightnesses are taken to have
+ * been measured with the sketch's own RED_CURRENT etc., or given OLD.EEP,
+ * with the table in that.
+ *
+ * The image runs from address 0 to the end of the table, with anything
+ * before DC_EEPROM left as it was in OLD.EEP (or erased), e.g.
+ *
+ *   avrdude -p m328p -c arduino -P /dev/ttyACM0 -U eeprom:w:DC.EEP:r
+ *
+ * The table is for the chain the sketch is built for (NUM_TLC, NUM_CHAINS
+ * and the fixture map), and the sketch won't use it on any other.
+ */
+
+#include "sketch.inc"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#define IMAGE_BYTES		(DC_EEPROM + DC_HEADER + 16*NUM_TLC)
+
+// The numbers in the file
+static std::vector<unsigned long> read_numbers(const char *path) {
+  std::vector<unsigned long> numbers;
+  FILE *in = fopen(path, "r");
+  char line[1024];
+
+  if (!in) {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), in)) {
+    char *end;
+
+    if (strchr(line, '#')) {
+      *strchr(line, '#') = 0;
+    }
+    for (char *word = strtok(line, " \t\r\n"); word; word = strtok(0, " \t\r\n")) {
+      unsigned long n = strtoul(word, &end, 10);
+
+      if (!isdigit((unsigned char)*word) || *end || n > 0xFFFF) {
+        fprintf(stderr, "dctable: %s: not a brightness: %s\n", path, word);
+        exit(1);
+      }
+      numbers.push_back(n);
+    }
+  }
+  fclose(in);
+  return numbers;
+}
+
+int main(int argc, char **argv) {
+  std::vector<unsigned long> measured;
+  unsigned long target = 0xFFFF;
+  byte table[16*NUM_TLC];
+  FILE *f;
+
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr, "usage: dctable MEASURED.txt DC.EEP [TARGET [OLD.EEP]]\n");
+    return 2;
+  }
+  measured = read_numbers(argv[1]);
+  if (measured.size() != 16*NUM_TLC) {
+    fprintf(stderr, "dctable: %s has %u brightnesses, not one for each of the %u channels\n",
+            argv[1], (unsigned int)measured.size(), 16*NUM_TLC);
+    return 1;
+  }
+  if (argc > 3) {
+    target = atol(argv[3]);
+  } else {
+    for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+      if (measured[channel] && measured[channel] < target) {
+        target = measured[channel];
+      }
+    }
+  }
+  if (argc > 4) {
+    f = fopen(argv[4], "rb");
+    if (!f) {
+      perror(argv[4]);
+      return 1;
+    }
+    fread(host_eeprom, 1, EEPROM_SIZE, f);
+    fclose(f);
+  }
+
+  // As the board starts up, so the table in OLD.EEP is checked and
+  // dc_value() gives what the brightnesses were measured with
+  tlc_model_begin(NUM_CHAINS, CHAIN_TLC);
+  setup();
+  if (!DC_TABLE_FITS) {
+    fprintf(stderr, "dctable: a table for %u chips doesn't fit in EEPROM\n", NUM_TLC);
+    return 1;
+  }
+  if (argc > 4 && !dc_from_eeprom) {
+    fprintf(stderr, "dctable: %s has no table for this chain\n", argv[4]);
+    return 1;
+  }
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    table[channel] = dc_scaled(dc_value(channel), target, measured[channel]);
+  }
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    EEPROM_WRITE(DC_EEPROM + DC_HEADER + channel, table[channel]);
+  }
+  dc_mark(1);
+
+  f = fopen(argv[2], "wb");
+  if (!f) {
+    perror(argv[2]);
+    return 1;
+  }
+  fwrite(host_eeprom, 1, IMAGE_BYTES, f);
+  if (fclose(f) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %u channels to %lu, layout %04x\n", argv[2], 16*NUM_TLC, target,
+         dc_layout());
+  return 0;
+}
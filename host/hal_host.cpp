@@ -0,0 +1,221 @@
+/*
+ * hal_host.cpp
+ *
+ * See hal_host.h.
+ */
+
+#include "hal_host.h"
+
+#include <time.h>
+
+std::string host_serial_out;
+std::deque<byte> host_serial_in;
+bool host_serial_echo = false;
+HostSerial Serial;
+
+byte host_advance = 0;
+byte host_back = 0;
+bool host_real_clock = false;
+
+byte host_spi_on = 0;
+byte host_spi_irq = 0;
+
+byte host_eeprom[EEPROM_SIZE];
+unsigned long host_eeprom_writes = 0;
+
+const char *host_show_path = "SHOW.BIN";
+
+namespace {
+
+// The made up clock, in microseconds
+unsigned long made_up_us = 0;
+// Whether interrupts are on, and whether one is running
+byte interrupts_on = 1;
+byte in_isr = 0;
+// Set by init_timers(), when the grayscale cycle interrupt starts
+byte timers_on = 0;
+// When the next grayscale cycle interrupt is due, and when the timer was
+// last restarted
+unsigned long gs_due = 0;
+unsigned long gs_restarted = 0;
+// Set while the SPI is sending a byte and until its interrupt has run, and
+// when the byte will have gone
+byte spi_busy = 0;
+unsigned long spi_due = 0;
+
+FILE *show_file = 0;
+
+struct eeprom_init {
+  eeprom_init() { memset(host_eeprom, 0xFF, sizeof(host_eeprom)); }
+} eeprom_init_;
+
+unsigned long now_us() {
+  if (host_real_clock) {
+    timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+  }
+  return made_up_us;
+}
+
+// Runs whichever interrupts are due, as the hardware would as soon as
+// interrupts are on
+void run_interrupts() {
+  if (!interrupts_on || in_isr) {
+    return;
+  }
+  in_isr = 1;
+  for (;;) {
+    if (spi_busy && host_spi_irq && (long)(now_us() - spi_due) >= 0) {
+      spi_busy = 0;
+      host_spi_isr();
+    } else if (timers_on && (long)(now_us() - gs_due) >= 0) {
+      // Like the timer, one interrupt however late it is
+      gs_due += HOST_GS_CYCLE_US;
+      if ((long)(now_us() - gs_due) >= 0) {
+        gs_due = now_us() + HOST_GS_CYCLE_US;
+      }
+      host_gs_isr();
+    } else {
+      break;
+    }
+  }
+  in_isr = 0;
+}
+
+// When the next interrupt is due
+unsigned long next_interrupt() {
+  if (spi_busy && host_spi_irq && (long)(spi_due - gs_due) < 0) {
+    return spi_due;
+  }
+  return gs_due;
+}
+
+}
+
+// The sketch only has an SPI interrupt with USE_SPI
+__attribute__((weak)) void host_spi_isr(void) {
+}
+
+unsigned long micros() {
+  if (!host_real_clock && !in_isr) {
+    made_up_us++;
+  }
+  run_interrupts();
+  return now_us();
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+int free_ram() {
+  // Nothing to go on here
+  return 0;
+}
+
+int HostSerial::read() {
+  byte b;
+
+  if (host_serial_in.empty()) {
+    return -1;
+  }
+  b = host_serial_in.front();
+  host_serial_in.pop_front();
+  return b;
+}
+
+void HostSerial::put(const std::string &s) {
+  host_serial_out += s;
+  if (host_serial_echo) {
+    fwrite(s.data(), 1, s.size(), stdout);
+  }
+}
+
+void host_interrupts(byte on) {
+  interrupts_on = on;
+  run_interrupts();
+}
+
+// Waiting with interrupts off would hang the board, so it stops here too
+void host_irq_wait() {
+  if (!interrupts_on || !timers_on) {
+    fprintf(stderr, "hal_host: waiting on interrupts that can't come\n");
+    abort();
+  }
+  if (!host_real_clock) {
+    // On to whichever interrupt is next
+    unsigned long next = next_interrupt();
+
+    if ((long)(made_up_us - next) < 0) {
+      made_up_us = next;
+    }
+  }
+  run_interrupts();
+}
+
+void host_busy(unsigned long us) {
+  unsigned long until = made_up_us + us;
+
+  while (timers_on && interrupts_on && (long)(until - next_interrupt()) > 0) {
+    made_up_us = next_interrupt();
+    run_interrupts();
+  }
+  made_up_us = until;
+  run_interrupts();
+}
+
+// In system clock cycles, 16 a microsecond
+unsigned int host_gs_timer_read() {
+  unsigned long cycles = (now_us() - gs_restarted) * 16;
+
+  return cycles > 0xFFFF ? 0xFFFF : cycles;
+}
+
+void host_gs_timer_restart() {
+  gs_restarted = now_us();
+}
+
+void host_spi_write(byte b) {
+  for (byte bit = 0x80; bit; bit >>= 1) {
+    tlc_model_sin(b & bit ? 1 : 0);
+    tlc_model_sclk(1);
+    tlc_model_sclk(0);
+  }
+  spi_busy = 1;
+  spi_due = now_us() + HOST_SPI_BYTE_US;
+}
+
+unsigned int host_noise_read() {
+  static uint32_t noise = 12345;
+
+  noise = noise * 1103515245 + 12345;
+  return noise >> 22;
+}
+
+void init_pins() {
+}
+
+void init_timers() {
+  timers_on = 1;
+  gs_restarted = now_us();
+  gs_due = gs_restarted + HOST_GS_CYCLE_US;
+}
+
+void init_spi() {
+  host_spi_on = 1;
+}
+
+byte init_sd() {
+  if (show_file) {
+    fclose(show_file);
+  }
+  show_file = fopen(host_show_path, "rb");
+  return show_file != 0;
+}
+
+byte show_read(unsigned long offset, void *buf, unsigned int length) {
+  return show_file && fseek(show_file, offset, SEEK_SET) == 0
+    && fread(buf, 1, length, show_file) == length;
+}
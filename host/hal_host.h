@@ -0,0 +1,214 @@
+/*
+ * hal_host.h
+ *
+ * The hardware abstraction layer of TLC5940_control.c (see HARDWARE
+ * ABSTRACTION there) for running the sketch on Linux.
+ *
+ * The TLC lines go to the model of the chain in tlc_model.h.  There are
+ * no real interrupts: the grayscale cycle and SPI interrupts come due as
+ * they would on the board (every 256us, and 1us after each byte is sent)
+ * and are run whenever the sketch waits on them (IRQ_WAIT()), turns
+ * interrupts back on or reads the clock.  That's a made up one that moves
+ * on 1us every time it's read and jumps ahead to the next interrupt
+ * whenever the sketch is waiting on one.  So a run does the same thing every time, and as fast
+ * as it will go.  Set host_real_clock to run off the PC's own clock
+ * instead, for the benchmarks.
+ *
+ * Serial, EEPROM and the show file are kept in memory or on disk, and can
+ * be got at by the test or tool that has the sketch built into it.
+ */
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "tlc_model.h"
+
+// ========= Arduino basics ============================================
+
+typedef uint8_t byte;
+
+#define _BV(bit)			(1U << (bit))
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	host_read_word(p)
+#define pgm_read_ptr(p)		(*(p))
+#define memcpy_P			memcpy
+#define F(s)				(s)
+
+// As Arduino.h has them, which is why the headers the tests and tools want
+// are included above
+#ifndef min
+#define min(a, b)			((a) < (b) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)			((a) > (b) ? (a) : (b))
+#endif
+
+// The bottom two bytes of whatever p points to, which on the AVR is all of
+// an int
+inline uint16_t host_read_word(const void *p) {
+  uint16_t word;
+
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+unsigned long micros();
+unsigned long millis();
+int free_ram();
+
+// What the sketch sends over serial goes into host_serial_out (and to
+// stdout as well if host_serial_echo is set); it reads from host_serial_in.
+extern std::string host_serial_out;
+extern std::deque<byte> host_serial_in;
+extern bool host_serial_echo;
+
+class HostSerial {
+public:
+  void begin(unsigned long) {}
+  int available() { return host_serial_in.size(); }
+  int availableForWrite() { return 64; }
+  int read();
+  void write(byte b) { put(std::string(1, (char)b)); }
+  void write(const byte *data, unsigned int length) {
+    put(std::string((const char *)data, length));
+  }
+  // As the Arduino one: numbers in decimal, floats to 2 places
+  void print(const char *s) { put(s); }
+  void print(char c) { put(std::string(1, c)); }
+  void print(double f) { number("%.2f", f); }
+  void print(unsigned char n) { number("%u", (unsigned int)n); }
+  void print(int n) { number("%d", n); }
+  void print(unsigned int n) { number("%u", n); }
+  void print(long n) { number("%ld", n); }
+  void print(unsigned long n) { number("%lu", n); }
+  template<class T> void println(T v) { print(v); put("\r\n"); }
+  void println() { put("\r\n"); }
+
+private:
+  void put(const std::string &s);
+  template<class T> void number(const char *format, T n) {
+    char text[32];
+    snprintf(text, sizeof(text), format, n);
+    put(text);
+  }
+};
+
+extern HostSerial Serial;
+
+// ========= TLC lines =================================================
+
+#define SCLK_HIGH()			tlc_model_sclk(1)
+#define SCLK_LOW()			tlc_model_sclk(0)
+#define SCLK_SIN_LOW()		(tlc_model_sclk(0), tlc_model_sin(0))
+#define SIN_HIGH()			tlc_model_sin(1)
+#define CHAIN_SIN_WRITE(b)	tlc_model_sin(b)
+#define XLAT_HIGH()			tlc_model_xlat(1)
+#define XLAT_LOW()			tlc_model_xlat(0)
+#define VPRG_HIGH()			tlc_model_vprg(1)
+#define VPRG_LOW()			tlc_model_vprg(0)
+#define BLANK_HIGH()		tlc_model_blank(1)
+#define BLANK_LOW()			tlc_model_blank(0)
+#define GSCLK_TOGGLE()		tlc_model_gsclk_toggle()
+#define BLANK_TOGGLE()		tlc_model_blank_toggle()
+
+// Cue advance/go back: set host_advance/host_back to press them
+extern byte host_advance;
+extern byte host_back;
+#define ADVANCE_RECEIVED()	(host_advance)
+#define BACK_RECEIVED()		(host_back)
+#define HDSHK_HIGH()		((void)0)
+#define HDSHK_LOW()			((void)0)
+
+// ========= Interrupts ================================================
+
+// Microseconds between grayscale cycle interrupts: 4096 GSCLKs at 16MHz
+#define HOST_GS_CYCLE_US	256
+// Microseconds the SPI takes to send a byte, at 8MHz
+#define HOST_SPI_BYTE_US	1
+
+// The sketch's interrupt routines
+void host_gs_isr(void);
+void host_spi_isr(void);
+
+// Whether micros() and millis() read the PC's clock rather than the made
+// up one
+extern bool host_real_clock;
+
+void host_interrupts(byte on);
+void host_irq_wait();
+// Runs the made up clock on by us, with every interrupt that comes due on
+// the way, as if the sketch had been busy that long (e.g. a frame that
+// runs long)
+void host_busy(unsigned long us);
+unsigned int host_gs_timer_read();
+void host_gs_timer_restart();
+
+#define INTERRUPTS_OFF()	host_interrupts(0)
+#define INTERRUPTS_ON()		host_interrupts(1)
+#define IRQ_WAIT()			host_irq_wait()
+#define GS_CYCLE_ISR()		void host_gs_isr(void)
+#define GS_TIMER_RESTART()	host_gs_timer_restart()
+#define GS_TIMER_READ()		host_gs_timer_read()
+#define SPI_ISR()			void host_spi_isr(void)
+
+// ========= SPI =======================================================
+
+extern byte host_spi_on;
+extern byte host_spi_irq;
+
+void host_spi_write(byte b);
+
+#define SPI_RUNNING()		(host_spi_on)
+#define SPI_WRITE(b)		host_spi_write(b)
+#define SPI_IRQ_ON()		(host_spi_irq = 1)
+#define SPI_IRQ_OFF()		(host_spi_irq = 0)
+#define SPI_STOP()			(host_spi_on = 0)
+
+// ========= EEPROM, noise and setup ===================================
+
+#define EEPROM_SIZE			1024
+extern byte host_eeprom[EEPROM_SIZE];
+// How many bytes have been written to host_eeprom
+extern unsigned long host_eeprom_writes;
+
+#define EEPROM_READ(a)		(host_eeprom[a])
+#define EEPROM_WRITE(a, b)	(host_eeprom[a] = (b), host_eeprom_writes++)
+#define EEPROM_UPDATE(a, b)	host_eeprom_update(a, b)
+#define EEPROM_READY()		(1)
+
+inline void host_eeprom_update(unsigned int a, byte b) {
+  if (host_eeprom[a] != b) {
+    EEPROM_WRITE(a, b);
+  }
+}
+
+// Noise as if from an unconnected analogue input, the same every run
+#define A0					14
+#define A5					19
+unsigned int host_noise_read();
+#define NOISE_READ()		host_noise_read()
+
+void init_pins();
+void init_timers();
+void init_spi();
+
+// ========= Show file =================================================
+
+// For SHOW_SD, the file init_sd() opens (SHOW.BIN if not set)
+extern const char *host_show_path;
+
+byte init_sd();
+byte show_read(unsigned long offset, void *buf, unsigned int length);
+
+#endif
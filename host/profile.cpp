@@ -0,0 +1,47 @@
+/*
+ * profile.cpp
+ *
+ * Prints the profile records (see Profiling in the sketch) in a file of
+ * what the board sent back, e.g. captured from its serial port after
+ * sending it PROFILE_REQUEST:
+ *
+ *   profile [FILE]
+ *
+ * Reads standard input if there's no FILE.  Anything between records is
+ * skipped.
+ */
+
+#include "sketch.inc"
+#include "profile.h"
+
+#include <vector>
+
+int main(int argc, char **argv) {
+  FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+  std::vector<byte> bytes;
+  struct profile_record record = {};
+  unsigned int records = 0;
+  int c;
+
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+  while ((c = fgetc(in)) != EOF) {
+    bytes.push_back(c);
+  }
+  for (unsigned int n = 0; n < bytes.size(); n++) {
+    if (profile_decode(&bytes[n], bytes.size() - n, &record)) {
+      if (records++) {
+        putchar('\n');
+      }
+      profile_print(&record, stdout);
+      n += PROFILE_RECORD_BYTES - 1;
+    }
+  }
+  if (!records) {
+    fprintf(stderr, "profile: no records of version %u\n", PROFILE_VERSION);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * profile.h
+ *
+ * Reads the sketch's binary profile record (see Profiling in the sketch)
+ * a field at a time, LSB first, so it doesn't matter how the PC would lay
+ * out struct profile_record, and prints it.  Included after the sketch,
+ * built with PROFILE 1.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+static const char *const PROFILE_STAGE_NAMES[PROFILE_STAGES] = {
+  "animate", "fades", "upload", "frame", "isr"
+};
+
+inline uint32_t profile_field(const byte **raw, byte bytes) {
+  uint32_t n = 0;
+
+  for (byte b = 0; b < bytes; b++) {
+    n |= (uint32_t)(*raw)[b] << (8 * b);
+  }
+  *raw += bytes;
+  return n;
+}
+
+// Fills in p from the PROFILE_RECORD_BYTES at raw.  Returns 0 if they
+// aren't a record of this version.
+inline byte profile_decode(const byte *raw, unsigned int length, struct profile_record *p) {
+  if (length < PROFILE_RECORD_BYTES || raw[0] != 'T' || raw[1] != 'P'
+      || raw[2] != PROFILE_VERSION || raw[3] != PROFILE_RECORD_BYTES) {
+    return 0;
+  }
+  memcpy(p->magic, raw, 2);
+  p->version = raw[2];
+  p->size = raw[3];
+  raw += 4;
+  p->start_ms = profile_field(&raw, 4);
+  p->end_ms = profile_field(&raw, 4);
+  p->frames_run = profile_field(&raw, 4);
+  p->frame_overruns = profile_field(&raw, 4);
+  p->frames_dropped = profile_field(&raw, 4);
+  p->gs_frames_sent = profile_field(&raw, 4);
+  p->gs_frames_skipped = profile_field(&raw, 4);
+  p->gs_latches = profile_field(&raw, 4);
+  p->gs_latches_dropped = profile_field(&raw, 4);
+  p->gs_upload_stalls = profile_field(&raw, 4);
+  p->fps_x100 = profile_field(&raw, 2);
+  p->isr_latency_max = profile_field(&raw, 2);
+  p->isr_cycles_max = profile_field(&raw, 2);
+  p->stages = profile_field(&raw, 2);
+  if (p->stages != PROFILE_STAGES) {
+    return 0;
+  }
+  for (byte stage = 0; stage < PROFILE_STAGES; stage++) {
+    struct profile_stage *s = &p->stage[stage];
+
+    s->count = profile_field(&raw, 4);
+    s->total = profile_field(&raw, 4);
+    s->min = profile_field(&raw, 2);
+    s->max = profile_field(&raw, 2);
+    for (byte bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+      s->hist[bucket] = profile_field(&raw, 2);
+    }
+  }
+  return 1;
+}
+
+inline void profile_print(const struct profile_record *p, FILE *out) {
+  fprintf(out, "%lu ms: %.2f fps, %lu frames run, %lu overran, %lu dropped\n",
+          (unsigned long)(p->end_ms - p->start_ms), p->fps_x100 / 100.0,
+          (unsigned long)p->frames_run, (unsigned long)p->frame_overruns,
+          (unsigned long)p->frames_dropped);
+  fprintf(out, "grayscale: %lu sent, %lu skipped, %lu latched, %lu latches dropped, "
+          "%lu upload stalls\n", (unsigned long)p->gs_frames_sent,
+          (unsigned long)p->gs_frames_skipped, (unsigned long)p->gs_latches,
+          (unsigned long)p->gs_latches_dropped, (unsigned long)p->gs_upload_stalls);
+  fprintf(out, "interrupt: in up to %u cycles late, took up to %u cycles (16 to a us)\n",
+          p->isr_latency_max, p->isr_cycles_max);
+  fprintf(out, "%-8s %8s %9s %6s %6s  (us in 4s, isr in cycles)\n", "stage", "count",
+          "mean", "min", "max");
+  for (byte stage = 0; stage < PROFILE_STAGES; stage++) {
+    const struct profile_stage *s = &p->stage[stage];
+
+    fprintf(out, "%-8s %8lu %9.1f %6u %6u ", PROFILE_STAGE_NAMES[stage],
+            (unsigned long)s->count, s->count ? (double)s->total / s->count : 0.0,
+            s->count ? s->min : 0, s->max);
+    for (byte bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+      fprintf(out, " %u", s->hist[bucket]);
+    }
+    fputc('\n', out);
+  }
+  fprintf(out, "histograms: <4, 4-7, 8-15 ... %u-%u, %u up\n",
+          1u << (PROFILE_BUCKETS - 1), (1u << PROFILE_BUCKETS) - 1, 1u << PROFILE_BUCKETS);
+}
+
+#endif
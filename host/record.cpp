@@ -0,0 +1,37 @@
+/*
+ * record.cpp
+ *
+ * Records a cue as a clip (see Clips in the sketch) on the PC, as
+ * RECORD_CUE does on the board, and prints it ready to paste in:
+ *
+ *   record CUE [SKIP [FRAMES [SHOW.BIN]]]
+ *
+ * SKIP and FRAMES are RECORD_SKIP and RECORD_FRAMES (0 and 500 if left
+ * out).  Given a show file (see showc), the cue is that show's rather than
+ * one of CUE_STEPS.  The clip is for the chain the sketch is built for.
+ */
+
+#include "sketch.inc"
+
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 5) {
+    fprintf(stderr, "usage: record CUE [SKIP [FRAMES [SHOW.BIN]]]\n");
+    return 2;
+  }
+  host_show_path = argc > 4 ? argv[4] : "";
+  tlc_model_begin(NUM_CHAINS, CHAIN_TLC);
+  setup();
+  if (argc > 4 && !show_on_sd) {
+    fprintf(stderr, "record: %s isn't a show file\n", argv[4]);
+    return 1;
+  }
+  if (find_cue(atoi(argv[1])) == NO_STEP) {
+    fprintf(stderr, "record: there's no cue %s\n", argv[1]);
+    return 1;
+  }
+  host_serial_echo = true;
+  record_clip(atoi(argv[1]), argc > 2 ? atoi(argv[2]) : 0, argc > 3 ? atoi(argv[3]) : 500);
+  return 0;
+}
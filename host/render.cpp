@@ -0,0 +1,319 @@
+/*
+ * render.cpp
+ *
+ * Plays cues of the show on the PC, as the sketch's preview does (see
+ * Preview in the sketch), and draws every frame as an image with each LED
+ * where a layout file puts it:
+ *
+ *   render [-png] LAYOUT DIR [CUES [FRAMES [SHOW.BIN]]]
+ *
+ * Cues 1 to CUES (1 if left out) are each played for FRAMES frames (750 if
+ * left out), FRAME_MS apart, into DIR/frame_00000.ppm and on (.png with
+ * -png), which has to be there already.  With DIR as -, the frames go one
+ * after another to stdout instead, as raw 8 bit RGB (PNGs with -png) for
+ * ffmpeg to read from a pipe:
+ *
+ *   render LAYOUT - 3 | ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -r 125 -i - show.mp4
+ *
+ * Given a show file (see showc), the cues are that show's rather than
+ * CUE_STEPS.
+ *
+ * A layout is the size of the image, how big each LED is drawn and where,
+ * # starting a comment:
+ *
+ *   size 90 10      # the image is 90 x 10 pixels
+ *   dot 4           # each LED is a disc of radius 4 (0 for one pixel)
+ *   5 5             # LED 0 is centred on pixel (5, 5)
+ *   15 5            # LED 1...
+ *
+ * LEDs the layout leaves out aren't drawn, and anything not under an LED
+ * is black.  The colours are preview_level()'s, with the dot correction
+ * and brightness curve the chain would have.
+ */
+
+#include "sketch.inc"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define MAX_LINE	1024
+#define MAX_SIZE	4096
+
+struct layout {
+  unsigned int width;
+  unsigned int height;
+  unsigned int dot;
+  std::vector<unsigned int> x;
+  std::vector<unsigned int> y;
+};
+
+static const char *source;
+static unsigned int line_number;
+
+static void fail(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  fprintf(stderr, "%s:%u: ", source, line_number);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+  exit(1);
+}
+
+// A word of the line as a whole number of up to max
+static unsigned int number(const char *word, unsigned int max) {
+  char *end;
+  unsigned long n;
+
+  if (!word || !isdigit((unsigned char)*word)) {
+    fail("wants a number");
+  }
+  n = strtoul(word, &end, 10);
+  if (*end || n > max) {
+    fail("not a number that fits: %s", word);
+  }
+  return n;
+}
+
+static void read_layout(const char *path, struct layout *layout) {
+  char line[MAX_LINE];
+  FILE *in;
+
+  source = path;
+  in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), in)) {
+    char *rest;
+    char *word;
+
+    line_number++;
+    if (strchr(line, '#')) {
+      *strchr(line, '#') = 0;
+    }
+    word = strtok_r(line, " \t\r\n", &rest);
+    if (!word) {
+      continue;
+    }
+    if (strcmp(word, "size") == 0) {
+      layout->width = number(strtok_r(0, " \t\r\n", &rest), MAX_SIZE);
+      layout->height = number(strtok_r(0, " \t\r\n", &rest), MAX_SIZE);
+    } else if (strcmp(word, "dot") == 0) {
+      layout->dot = number(strtok_r(0, " \t\r\n", &rest), MAX_SIZE);
+    } else {
+      if (!layout->width || !layout->height) {
+        fail("an LED before the size");
+      }
+      if (layout->x.size() == NUM_LED) {
+        fail("more than the %u LEDs the sketch has", NUM_LED);
+      }
+      layout->x.push_back(number(word, MAX_SIZE));
+      layout->y.push_back(number(strtok_r(0, " \t\r\n", &rest), MAX_SIZE));
+      if (layout->x.back() >= layout->width || layout->y.back() >= layout->height) {
+        fail("LED %u is off the image", (unsigned int)layout->x.size() - 1);
+      }
+    }
+    if (strtok_r(0, " \t\r\n", &rest)) {
+      fail("too much on the line");
+    }
+  }
+  fclose(in);
+  if (layout->x.empty()) {
+    fail("no LEDs");
+  }
+}
+
+// Every LED as it is now, drawn onto an image of 8 bit RGB
+static void draw(const struct layout *layout, std::vector<byte> &image) {
+  const byte lanes[3] = {RED_L, GREEN_L, BLUE_L};
+  int dot = layout->dot;
+
+  std::fill(image.begin(), image.end(), 0);
+  for (unsigned int led = 0; led < layout->x.size(); led++) {
+    byte rgb[3];
+
+    for (byte colour = 0; colour < 3; colour++) {
+      rgb[colour] = preview_level(LED_CHANNEL(led, lanes[colour]));
+    }
+    for (int dy = -dot; dy <= dot; dy++) {
+      for (int dx = -dot; dx <= dot; dx++) {
+        int x = layout->x[led] + dx;
+        int y = layout->y[led] + dy;
+
+        if (dx*dx + dy*dy <= dot*dot && x >= 0 && y >= 0
+            && x < (int)layout->width && y < (int)layout->height) {
+          memcpy(&image[3 * (y*layout->width + x)], rgb, 3);
+        }
+      }
+    }
+  }
+}
+
+static void write_ppm(FILE *f, const struct layout *layout, const std::vector<byte> &image) {
+  fprintf(f, "P6\n%u %u\n255\n", layout->width, layout->height);
+  fwrite(&image[0], 1, image.size(), f);
+}
+
+// ========= PNG, uncompressed =========================================
+
+static uint32_t crc32(uint32_t crc, const byte *data, unsigned int length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    for (byte bit = 0; bit < 8; bit++) {
+      crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static void put_number(std::vector<byte> &out, uint32_t n) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(n >> shift);
+  }
+}
+
+static void write_chunk(FILE *f, const char *type, const std::vector<byte> &data) {
+  std::vector<byte> chunk;
+
+  put_number(chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  // Of the type and data, not the length
+  put_number(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+  fwrite(&chunk[0], 1, chunk.size(), f);
+}
+
+// The rows, each after a 0 (no filter), as a zlib stream of stored
+// deflate blocks
+static void write_png(FILE *f, const struct layout *layout, const std::vector<byte> &image) {
+  static const byte signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  unsigned int row = 3 * layout->width;
+  std::vector<byte> raw;
+  std::vector<byte> header;
+  std::vector<byte> data;
+  uint32_t a = 1;
+  uint32_t b = 0;
+
+  for (unsigned int y = 0; y < layout->height; y++) {
+    raw.push_back(0);
+    raw.insert(raw.end(), image.begin() + y*row, image.begin() + (y + 1)*row);
+  }
+  put_number(header, layout->width);
+  put_number(header, layout->height);
+  // 8 bits of RGB, deflated, filtered, not interlaced
+  header.push_back(8);
+  header.push_back(2);
+  header.push_back(0);
+  header.push_back(0);
+  header.push_back(0);
+
+  data.push_back(0x78);
+  data.push_back(0x01);
+  for (unsigned int at = 0; at < raw.size(); at += 0xFFFF) {
+    unsigned int length = min(raw.size() - at, 0xFFFFU);
+
+    data.push_back(at + length == raw.size());
+    data.push_back(length);
+    data.push_back(length >> 8);
+    data.push_back(~length);
+    data.push_back(~length >> 8);
+    data.insert(data.end(), raw.begin() + at, raw.begin() + at + length);
+  }
+  for (unsigned int n = 0; n < raw.size(); n++) {
+    a = (a + raw[n]) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_number(data, b << 16 | a);
+
+  fwrite(signature, 1, sizeof(signature), f);
+  write_chunk(f, "IHDR", header);
+  write_chunk(f, "IDAT", data);
+  write_chunk(f, "IEND", std::vector<byte>());
+}
+
+int main(int argc, char **argv) {
+  struct layout layout = {};
+  bool png = argc > 1 && strcmp(argv[1], "-png") == 0;
+  char **args = argv + png;
+  int count = argc - png;
+  bool piped = count > 2 && strcmp(args[2], "-") == 0;
+  // stdout is the frames when they're piped
+  FILE *report = piped ? stderr : stdout;
+  int cues;
+  unsigned int frames;
+  unsigned long clock = 0;
+  unsigned int written = 0;
+  std::vector<byte> image;
+
+  if (count < 3 || count > 6) {
+    fprintf(stderr, "usage: render [-png] LAYOUT DIR [CUES [FRAMES [SHOW.BIN]]]\n");
+    return 2;
+  }
+  read_layout(args[1], &layout);
+  image.resize(3 * layout.width * layout.height);
+  cues = count > 3 ? atoi(args[3]) : 1;
+  frames = count > 4 ? atoi(args[4]) : 750;
+
+  host_show_path = count > 5 ? args[5] : "";
+  tlc_model_begin(NUM_CHAINS, CHAIN_TLC);
+  setup();
+  if (count > 5 && !show_on_sd) {
+    fprintf(stderr, "render: %s isn't a show file\n", args[5]);
+    return 1;
+  }
+
+  // As preview_show() plays them
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  for (int c = 1; c <= cues; c++) {
+    if (find_cue(c) == NO_STEP) {
+      fprintf(stderr, "render: there's no cue %d\n", c);
+      return 1;
+    }
+    preview_cue(c);
+    for (unsigned int frame = 0; frame < frames; frame++) {
+      char path[1024];
+      FILE *f;
+
+      preview_step(clock);
+      clock += FRAME_MS;
+      draw(&layout, image);
+      if (piped) {
+        if (png) {
+          write_png(stdout, &layout, image);
+        } else {
+          fwrite(&image[0], 1, image.size(), stdout);
+        }
+        written++;
+        continue;
+      }
+      snprintf(path, sizeof(path), "%s/frame_%05u.%s", args[2], written++, png ? "png" : "ppm");
+      f = fopen(path, "wb");
+      if (!f) {
+        perror(path);
+        return 1;
+      }
+      if (png) {
+        write_png(f, &layout, image);
+      } else {
+        write_ppm(f, &layout, image);
+      }
+      if (fclose(f) != 0) {
+        perror(path);
+        return 1;
+      }
+    }
+  }
+  if (piped && fflush(stdout) != 0) {
+    perror("render: stdout");
+    return 1;
+  }
+  fprintf(report, "%s: %u frames of %u x %u\n", piped ? "stdout" : args[2], written,
+          layout.width, layout.height);
+  return 0;
+}
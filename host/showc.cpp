@@ -0,0 +1,315 @@
+/*
+ * showc.cpp
+ *
+ * Compiles a text description of a show into a show file for SHOW_SD (see
+ * Cue List in the sketch for the file, and README.md for the text):
+ *
+ *   showc SHOW.txt SHOW.BIN
+ *
+ * Built with the sketch, so the effects, colours and clips it knows by
+ * name and the steps it writes (step_encode()) are the sketch's own.
+ */
+
+#include "sketch.inc"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define MAX_LINE	1024
+
+struct name {
+  const char *name;
+  byte value[3];
+  byte size;
+};
+
+static const struct name EFFECTS[] = {
+  {"none", {EFFECT_NONE}, 1},
+  {"all_off", {EFFECT_ALL_OFF}, 1},
+  {"all_on", {EFFECT_ALL_ON}, 1},
+  {"fades", {EFFECT_FADES}, 1},
+  {"runners", {EFFECT_RUNNERS}, 1},
+  {"counting", {EFFECT_COUNTING}, 1},
+  {"raindrops", {EFFECT_RAINDROPS}, 1},
+  {"pattern_invert", {EFFECT_PATTERN_INVERT}, 1},
+  {"pattern_shift", {EFFECT_PATTERN_SHIFT}, 1},
+  {"binary_counter", {EFFECT_BINARY_COUNTER}, 1},
+  {"playback", {EFFECT_PLAYBACK}, 1},
+  {0, {0}, 0}
+};
+
+static const struct name BLENDS[] = {
+  {"replace", {BLEND_REPLACE}, 1},
+  {"add", {BLEND_ADD}, 1},
+  {"max", {BLEND_MAX}, 1},
+  {"multiply", {BLEND_MULTIPLY}, 1},
+  {"alpha", {BLEND_ALPHA}, 1},
+  {0, {0}, 0}
+};
+
+// What can go in colours and args besides numbers; a colour is all three
+// of its values
+static const struct name VALUES[] = {
+  {"BLACK", {BLACK}, 3},
+  {"WHITE", {WHITE}, 3},
+  {"RED", {RED}, 3},
+  {"GREEN", {GREEN}, 3},
+  {"BLUE", {BLUE}, 3},
+  {"YELLOW", {YELLOW}, 3},
+  {"PINK", {PINK}, 3},
+  {"CYAN", {CYAN}, 3},
+  {"ORANGE", {ORANGE}, 3},
+  {"PURPLE", {PURPLE}, 3},
+  {"BACKWARDS", {BACKWARDS}, 1},
+  {"CLIP_PATTERN_SHIFT", {CLIP_PATTERN_SHIFT}, 1},
+  {0, {0}, 0}
+};
+
+static const char *source;
+static unsigned int line_number;
+
+static void fail(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  fprintf(stderr, "%s:%u: ", source, line_number);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+  exit(1);
+}
+
+static const struct name *find_name(const struct name *names, const char *name) {
+  for (; names->name; names++) {
+    if (strcmp(names->name, name) == 0) {
+      return names;
+    }
+  }
+  return 0;
+}
+
+// A whole number of up to max, in decimal or 0x hex
+static uint32_t number(const char *text, uint32_t max) {
+  char *end;
+  unsigned long long n;
+
+  if (!isdigit((unsigned char)*text)) {
+    fail("not a number: %s", text);
+  }
+  n = strtoull(text, &end, 0);
+  if (*end || n > max) {
+    fail("not a number that fits: %s", text);
+  }
+  return n;
+}
+
+// Fills out with the comma separated list in text, each a number from 0
+// to 255 or one of VALUES, and returns how many values that came to
+static byte byte_list(char *text, byte *out, byte size) {
+  byte length = 0;
+
+  for (char *item = strtok(text, ","); item; item = strtok(0, ",")) {
+    const struct name *value = find_name(VALUES, item);
+    byte one = 0;
+    const byte *values = &one;
+    byte count = 1;
+
+    if (value) {
+      values = value->value;
+      count = value->size;
+    } else {
+      one = number(item, 255);
+    }
+    if (length + count > size) {
+      fail("more than %u values", size);
+    }
+    memcpy(out + length, values, count);
+    length += count;
+  }
+  return length;
+}
+
+// Two comma separated numbers
+static void number_pair(char *text, uint32_t *first, uint32_t max_first,
+                        uint32_t *second, uint32_t max_second) {
+  char *comma = strchr(text, ',');
+
+  if (!comma) {
+    fail("wants two numbers: %s", text);
+  }
+  *comma = 0;
+  *first = number(text, max_first);
+  *second = number(comma + 1, max_second);
+}
+
+// One word of a step: a flag, or key=value
+static void step_word(char *word, struct cue_step *step) {
+  char *value = strchr(word, '=');
+  uint32_t first;
+  uint32_t second;
+
+  if (!value) {
+    if (strcmp(word, "count") == 0) {
+      step->flags |= STEP_COUNT;
+    } else if (strcmp(word, "reset") == 0) {
+      step->flags |= STEP_RESET;
+    } else if (strcmp(word, "with") == 0) {
+      step->flags |= STEP_WITH;
+    } else {
+      fail("don't know %s", word);
+    }
+    return;
+  }
+  *value++ = 0;
+  if (strcmp(word, "at") == 0) {
+    step->advance_at = strcmp(value, "never") == 0 ? NEVER : number(value, NEVER - 1);
+  } else if (strcmp(word, "colours") == 0) {
+    if (byte_list(value, step->colours, sizeof(step->colours)) != sizeof(step->colours)) {
+      fail("colours wants 11 values: background, foreground 1, foreground 2, fade_style"
+           " and number of increments");
+    }
+    step->flags |= STEP_COLOURS;
+  } else if (strcmp(word, "pattern") == 0) {
+    step->pattern = number(value, 0xFFFF);
+  } else if (strcmp(word, "args") == 0) {
+    byte_list(value, step->args, sizeof(step->args));
+  } else if (strcmp(word, "loop") == 0) {
+    number_pair(value, &first, 255, &second, NEVER - 1);
+    step->loop_to = first;
+    step->loop_counter = second;
+    step->flags |= STEP_LOOP;
+  } else if (strcmp(word, "leds") == 0) {
+    number_pair(value, &first, 0xFFFF, &second, 0xFFFF);
+    step->first_led = first;
+    step->num_leds = second;
+  } else if (strcmp(word, "blend") == 0) {
+    const struct name *blend = find_name(BLENDS, value);
+
+    if (!blend) {
+      fail("no blend mode %s", value);
+    }
+    step->blend = blend->value[0];
+  } else if (strcmp(word, "opacity") == 0) {
+    step->opacity = number(value, 255);
+  } else {
+    fail("don't know %s=", word);
+  }
+}
+
+// Marks the end of cue number cue, whose steps start at first, once it's
+// checked that the cue can end there
+static void end_cue(std::vector<struct cue_step> &steps, unsigned int first, unsigned int cue) {
+  unsigned int lead = first;
+
+  if (steps.size() == first) {
+    fail("cue %u has no steps", cue);
+  }
+  for (unsigned int n = first; n < steps.size(); n++) {
+    if ((steps[n].flags & STEP_LOOP) && steps[n].loop_to >= steps.size() - first) {
+      fail("a loop goes past the end of cue %u", cue);
+    }
+    if (n > first && !(steps[n - 1].flags & STEP_WITH)) {
+      lead = n;
+    }
+  }
+  if (steps.back().flags & STEP_WITH) {
+    fail("the last step of cue %u can't be with the next", cue);
+  }
+  if (steps[lead].advance_at != NEVER && !(steps[lead].flags & STEP_LOOP)) {
+    fail("the last step of cue %u has to be at=never or a loop", cue);
+  }
+  steps.back().flags |= STEP_END;
+}
+
+int main(int argc, char **argv) {
+  std::vector<struct cue_step> steps;
+  unsigned int cues = 0;
+  unsigned int first = 0;
+  char line[MAX_LINE];
+  FILE *in;
+  FILE *out;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: showc SHOW.txt SHOW.BIN\n");
+    return 2;
+  }
+  source = argv[1];
+  in = fopen(source, "r");
+  if (!in) {
+    perror(source);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), in)) {
+    char *word;
+    char *rest;
+
+    line_number++;
+    if (!strchr(line, '\n') && !feof(in)) {
+      fail("line longer than %u characters", MAX_LINE - 1);
+    }
+    if (strchr(line, '#')) {
+      *strchr(line, '#') = 0;
+    }
+    word = strtok_r(line, " \t\r\n", &rest);
+    if (!word) {
+      continue;
+    }
+    if (strcmp(word, "cue") == 0) {
+      word = strtok_r(0, " \t\r\n", &rest);
+      if (!word || number(word, 0xFFFF) != cues + 1 || strtok_r(0, " \t\r\n", &rest)) {
+        fail("wants cue %u", cues + 1);
+      }
+      if (cues) {
+        end_cue(steps, first, cues);
+      }
+      cues++;
+      first = steps.size();
+    } else {
+      const struct name *effect = find_name(EFFECTS, word);
+      struct cue_step step = {};
+
+      step.advance_at = NEVER;
+      if (!cues) {
+        fail("%s before the first cue", word);
+      }
+      if (!effect) {
+        fail("no effect %s", word);
+      }
+      step.effect = effect->value[0];
+      while ((word = strtok_r(0, " \t\r\n", &rest))) {
+        step_word(word, &step);
+      }
+      steps.push_back(step);
+    }
+  }
+  fclose(in);
+  if (!cues) {
+    fail("no cues in %s", source);
+  }
+  end_cue(steps, first, cues);
+  if (steps.size() > 0xFFFF) {
+    fail("more than 65535 steps");
+  }
+
+  out = fopen(argv[2], "wb");
+  if (!out) {
+    perror(argv[2]);
+    return 1;
+  }
+  byte header[SHOW_HEADER] = {'T', 'L', 'C', 'S', SHOW_VERSION, SHOW_STEP_BYTES};
+  byte raw[SHOW_STEP_BYTES];
+
+  show_put_number(header + 6, steps.size(), 2);
+  fwrite(header, 1, SHOW_HEADER, out);
+  for (unsigned int n = 0; n < steps.size(); n++) {
+    step_encode(&steps[n], raw);
+    fwrite(raw, 1, SHOW_STEP_BYTES, out);
+  }
+  if (fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %u cues, %u steps\n", argv[2], cues, (unsigned int)steps.size());
+  return 0;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Turns the sketch into C++ that builds against hal_host.h.
+
+    sketch.py SKETCH OUTPUT [NAME=VALUE ...]
+
+Each NAME=VALUE replaces the value of the sketch's own #define NAME, so a
+test or tool can be built for any set of options without touching the
+sketch.  As the Arduino IDE does, a prototype is put in up front for every
+function, since the sketch uses functions before it defines them.
+"""
+
+import re
+import sys
+
+DEFINE = r'^(#define[ \t]+{0}[ \t]+)([^\n]*?)([ \t]*//[^\n]*)?$'
+# A function definition starting at the beginning of a line, with its
+# parameters on one line or several
+FUNCTION = re.compile(r'^([A-Za-z_][\w \t\*]*?[ \t\*](\w+)[ \t]*\(([^;{}()]*)\))[ \t]*\{',
+                      re.M)
+NOT_FUNCTIONS = {'if', 'for', 'while', 'switch', 'return', 'sizeof'}
+
+
+def configure(source, settings):
+    for setting in settings:
+        name, _, value = setting.partition('=')
+        pattern = re.compile(DEFINE.format(re.escape(name)), re.M)
+        source, found = pattern.subn(
+            lambda m: m.group(1) + value + (m.group(3) or ''), source, count=1)
+        if not found:
+            sys.exit('sketch.py: the sketch has no #define %s' % name)
+    return source
+
+
+def prototypes(source):
+    found = []
+    for match in FUNCTION.finditer(source):
+        head = match.group(1)
+        if match.group(2) in NOT_FUNCTIONS or head.startswith(('struct ', 'union ')):
+            continue
+        found.append(re.sub(r'\s+', ' ', head) + ';')
+    return found
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    sketch, output, settings = sys.argv[1], sys.argv[2], sys.argv[3:]
+    with open(sketch) as f:
+        source = configure(f.read(), settings)
+    with open(output, 'w') as f:
+        f.write('// Made by sketch.py from %s %s\n' % (sketch, ' '.join(settings)))
+        f.write('#include "hal_host.h"\n\n')
+        f.write('\n'.join(prototypes(source)) + '\n\n')
+        f.write('#line 1 "%s"\n' % sketch)
+        f.write(source)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,121 @@
+/*
+ * test_clip.cpp
+ *
+ * Checks clips (see Clips in the sketch): that recording the CLIP_DEMO
+ * cue gives CLIP_PATTERN_SHIFT_DATA as it is in the sketch, that playing
+ * it back gives every frame the cue did, and that a clip with more
+ * channels than the chain sets the ones there are and keeps its place.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#include <stdlib.h>
+#include <vector>
+
+#define DEMO_CUE		27
+#define PLAYBACK_CUE	28
+#define DEMO_SKIP		18
+#define DEMO_FRAMES		108
+
+typedef std::vector<byte> frame;
+
+// The numbers in the C that record_clip() printed, leaving out comments
+static std::vector<byte> printed_bytes(const std::string &out) {
+  std::vector<byte> bytes;
+  const char *p = strchr(out.c_str(), '{');
+
+  while (p && *p) {
+    if (*p >= '0' && *p <= '9') {
+      bytes.push_back(strtoul(p, (char **)&p, 10));
+    } else {
+      p++;
+    }
+  }
+  return bytes;
+}
+
+static void check_recording() {
+  std::vector<byte> bytes;
+
+  host_serial_out.clear();
+  record_clip(DEMO_CUE, DEMO_SKIP, DEMO_FRAMES);
+  bytes = printed_bytes(host_serial_out);
+  CHECK(bytes.size() == sizeof(CLIP_PATTERN_SHIFT_DATA), "%u bytes recorded, not %u",
+        (unsigned int)bytes.size(), (unsigned int)sizeof(CLIP_PATTERN_SHIFT_DATA));
+  CHECK(bytes.size() == sizeof(CLIP_PATTERN_SHIFT_DATA)
+        && memcmp(&bytes[0], CLIP_PATTERN_SHIFT_DATA, bytes.size()) == 0,
+        "recording isn't CLIP_PATTERN_SHIFT_DATA");
+}
+
+// Runs cue c from the start for frames frames, FRAME_MS apart, and gives
+// back the channels of each
+static std::vector<frame> run_cue(int c, unsigned int frames) {
+  std::vector<frame> out;
+
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  restart_effects();
+  auto_advance_counter = 0;
+  sub_cue = 0;
+  cue = c;
+  for (unsigned int n = 0; n < frames; n++) {
+    frame_ms = n * FRAME_MS;
+    animate();
+    perform_fades();
+    out.push_back(frame(new_grayscale_values, new_grayscale_values + 16*NUM_TLC));
+  }
+  return out;
+}
+
+static void check_playback() {
+  std::vector<frame> live = run_cue(DEMO_CUE, DEMO_SKIP + 2*DEMO_FRAMES);
+  std::vector<frame> played = run_cue(PLAYBACK_CUE, 2*DEMO_FRAMES);
+
+  // Twice round, so the loop back to the start is checked too
+  for (unsigned int n = 0; n < 2*DEMO_FRAMES && !CHECK_QUIET(); n++) {
+    CHECK(played[n] == live[DEMO_SKIP + n], "frame %u played differently", n);
+  }
+}
+
+// Two frames, the first with a run that goes 3 channels past the end of
+// the chips and then one wholly past it
+static void check_long_clip() {
+  std::vector<byte> clip;
+  const byte *next;
+
+  clip.push_back(16*NUM_TLC - 2);
+  clip.push_back(5);
+  for (byte n = 0; n < 5; n++) {
+    clip.push_back(100 + n);
+  }
+  clip.push_back(10);
+  clip.push_back(2);
+  clip.push_back(7);
+  clip.push_back(7);
+  clip.push_back(0);
+  clip.push_back(0);
+  clip.push_back(0);
+  clip.push_back(1);
+  clip.push_back(42);
+  clip.push_back(0);
+  clip.push_back(0);
+
+  memset(new_grayscale_values, 0, sizeof(new_grayscale_values));
+  next = play_clip_frame(&clip[0]);
+  CHECK(next == &clip[13], "first frame ended at %d", (int)(next - &clip[0]));
+  CHECK(new_grayscale_values[16*NUM_TLC - 2] == 100
+        && new_grayscale_values[16*NUM_TLC - 1] == 101, "last channels %u, %u",
+        new_grayscale_values[16*NUM_TLC - 2], new_grayscale_values[16*NUM_TLC - 1]);
+  next = play_clip_frame(next);
+  CHECK(next == &clip[18], "second frame ended at %d", (int)(next - &clip[0]));
+  CHECK(new_grayscale_values[0] == 42, "channel 0 %u", new_grayscale_values[0]);
+}
+
+int main(int, char **argv) {
+  host_power_on();
+  check_recording();
+  check_playback();
+  check_long_clip();
+  return check_done(argv[0]);
+}
@@ -0,0 +1,134 @@
+/*
+ * test_dc.cpp
+ *
+ * Checks the dot correction table: that one sent with DC_MEASURED gets to
+ * the chips, that it's what dctable makes from the same brightnesses, and
+ * that a table saved for another layout of the chain isn't used.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#define MEASURED		"dc/example.txt"
+#define DCTABLE_IMAGE	"build/dc.eep"
+#define IMAGE_BYTES		(DC_EEPROM + DC_HEADER + 16*NUM_TLC)
+
+static byte measured[16*NUM_TLC];
+static byte expected[16*NUM_TLC];
+
+// The brightnesses dctable was given, and the dimmest of them
+static byte read_measured() {
+  FILE *in = fopen(MEASURED, "r");
+  char line[1024];
+  unsigned int channels = 0;
+  byte target = 255;
+
+  CHECK(in, "no %s", MEASURED);
+  while (in && fgets(line, sizeof(line), in)) {
+    if (strchr(line, '#')) {
+      *strchr(line, '#') = 0;
+    }
+    for (char *word = strtok(line, " \t\r\n"); word && channels < 16*NUM_TLC;
+         word = strtok(0, " \t\r\n")) {
+      measured[channels++] = atoi(word);
+    }
+  }
+  if (in) {
+    fclose(in);
+  }
+  CHECK(channels == 16*NUM_TLC, "%u brightnesses", channels);
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    if (measured[channel] && measured[channel] < target) {
+      target = measured[channel];
+    }
+  }
+  return target;
+}
+
+static void check_chips(const char *when) {
+  for (unsigned int channel = 0; channel < 16*NUM_TLC && !CHECK_QUIET(); channel++) {
+    CHECK(tlc_model_dc(channel) == expected[channel], "%s: channel %u has %u, not %u", when,
+          channel, tlc_model_dc(channel), expected[channel]);
+  }
+}
+
+// Sent over serial as the PC would, a byte a frame
+static void check_measured(byte target) {
+  std::string sent;
+  byte last = tlc_model_dc(16*NUM_TLC - 1);
+
+  sent += (char)DC_MEASURED;
+  sent += (char)target;
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    expected[channel] = dc_scaled(dc_value(channel), target, measured[channel]);
+    sent += (char)measured[channel];
+  }
+  host_serial_out.clear();
+  host_serial_in.insert(host_serial_in.end(), sent.begin(), sent.end());
+  for (unsigned int frame = 0; frame < sent.size() + 4; frame++) {
+    loop();
+  }
+  CHECK(!dc_receiving && dc_from_eeprom, "table not taken");
+  CHECK(host_serial_out == sent.substr(1), "%u bytes echoed of %u",
+        (unsigned int)host_serial_out.size(), (unsigned int)sent.size() - 1);
+  host_wait_latched();
+  check_chips("sent");
+  // Channels measured at 0 are left be
+  CHECK(measured[16*NUM_TLC - 1] == 0 && tlc_model_dc(16*NUM_TLC - 1) == last,
+        "last channel %u, was %u", tlc_model_dc(16*NUM_TLC - 1), last);
+}
+
+// What dctable made of the same brightnesses
+static void check_dctable() {
+  FILE *f = fopen(DCTABLE_IMAGE, "rb");
+  byte image[IMAGE_BYTES + 1];
+
+  CHECK(f, "no %s", DCTABLE_IMAGE);
+  if (!f) {
+    return;
+  }
+  CHECK(fread(image, 1, sizeof(image), f) == IMAGE_BYTES, "%s isn't %u bytes", DCTABLE_IMAGE,
+        IMAGE_BYTES);
+  fclose(f);
+  CHECK(memcmp(image, host_eeprom, IMAGE_BYTES) == 0, "%s isn't the table sent",
+        DCTABLE_IMAGE);
+}
+
+static void check_layout() {
+  uint16_t layout = dc_layout();
+  byte header[DC_HEADER];
+
+  memcpy(header, &host_eeprom[DC_EEPROM], DC_HEADER);
+  CHECK(header[0] == (byte)layout && header[1] == layout >> 8, "header %02x %02x, layout %04x",
+        header[0], header[1], layout);
+
+  // Switched back on, it's still there
+  host_power_on();
+  CHECK(dc_from_eeprom, "table not used after power on");
+  check_chips("power on");
+
+  // A table for another layout, or from before there were layouts
+  for (byte n = 0; n < DC_HEADER; n++) {
+    host_eeprom[DC_EEPROM + n] ^= 0x10;
+    load_dc();
+    CHECK(!dc_from_eeprom, "table used with header byte %u changed", n);
+    host_eeprom[DC_EEPROM + n] = header[n];
+  }
+  host_eeprom[DC_EEPROM] = NUM_TLC;
+  load_dc();
+  CHECK(header[0] == NUM_TLC || !dc_from_eeprom, "old table used");
+  host_eeprom[DC_EEPROM] = header[0];
+  load_dc();
+  CHECK(dc_from_eeprom, "table not used again");
+}
+
+int main(int, char **argv) {
+  byte target = read_measured();
+
+  host_power_on();
+  CHECK(!dc_from_eeprom, "table in blank EEPROM");
+  check_measured(target);
+  check_dctable();
+  check_layout();
+  return check_done(argv[0]);
+}
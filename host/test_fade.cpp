@@ -0,0 +1,136 @@
+/*
+ * test_fade.cpp
+ *
+ * Checks the fade engine: that fade_lanes() gives what a channel's fade
+ * works out to, one channel at a time, for every start, rise, fall and
+ * progress, right up to where it saturates at 0 and 255.996, and what
+ * led_fade_to() and led_set_new() do when an LED is given the colour it's
+ * already fading to.  Built with the SSE2 and plain C versions of the sums
+ * and the one lane at a time one (see Makefile).
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#define RANDOM_LANES	10000000UL
+
+// Where one channel of a fade is in 8.8: up from from at up*progress/256,
+// stopping at 255.996, then down at down*progress/256, stopping at 0
+static unsigned int channel_fade(byte from, byte up, byte down, unsigned int progress) {
+  long level = 256L*from + (long)up*progress;
+
+  level = level > 0xFFFF ? 0xFFFF : level;
+  level -= (long)down*progress;
+  return level < 0 ? 0 : level;
+}
+
+static uint32_t random32() {
+  return ((uint32_t)rand() << 16) ^ rand();
+}
+
+static void check_lanes(uint32_t from, uint32_t up, uint32_t down, unsigned int progress) {
+  uint64_t lanes = fade_lanes(from, up, down, progress);
+
+  for (byte lane = 0; lane < 4; lane++) {
+    unsigned int got = (lanes >> 16*lane) & 0xFFFF;
+    unsigned int want = channel_fade(from >> 8*lane, up >> 8*lane, down >> 8*lane, progress);
+
+    CHECK(got == want, "from %08x up %08x down %08x progress %u: lane %u %04x, not %04x",
+          from, up, down, progress, lane, got, want);
+  }
+}
+
+// Every pair of levels a and b in each lane a different way, for every
+// progress: from a rising by b, falling by b, and both, and from b rising
+// by a and falling by 255 - a.  That has every fade a channel can be given
+// and every way one can go past 255.996 or 0.  Then random fades.
+static void check_fade_lanes() {
+  uint32_t from;
+  uint32_t up;
+  uint32_t down;
+
+  for (unsigned int a = 0; a < 256 && !CHECK_QUIET(); a++) {
+    for (unsigned int b = 0; b < 256 && !CHECK_QUIET(); b++) {
+      from = a | a << 8 | a << 16 | b << 24;
+      up = b | b << 16 | a << 24;
+      down = b << 8 | b << 16 | (255 - a) << 24;
+      for (unsigned int progress = 0; progress <= 256; progress++) {
+        check_lanes(from, up, down, progress);
+      }
+    }
+  }
+  // The very ends
+  CHECK(fade_lanes(0xFFFFFFFF, 0xFFFFFFFF, 0, 256) == 0xFFFFFFFFFFFFFFFFULL, "not saturated up");
+  CHECK(fade_lanes(0, 0, 0xFFFFFFFF, 256) == 0, "not saturated down");
+  srand(7);
+  for (unsigned long n = 0; n < RANDOM_LANES && !CHECK_QUIET(); n++) {
+    from = random32();
+    up = random32();
+    down = random32();
+    check_lanes(from, up, down, rand() % 257);
+  }
+}
+
+// Moves the fades on to ms
+static void fades_at(unsigned long ms) {
+  frame_ms = ms;
+  perform_fades();
+}
+
+static byte led_fading(unsigned int led) {
+  return (fading[led >> 3] & _BV(led & 7)) != 0;
+}
+
+static void check_same_colour() {
+  byte red;
+
+  // The same colour over the same time carries on as it was
+  fades_at(0);
+  led_fade_to(0, 200, 100, 50, 1000);
+  fades_at(500);
+  red = get_led_red(0);
+  CHECK(red > 0 && red < 200, "red %u half way", red);
+  led_fade_to(0, 200, 100, 50, 1000);
+  CHECK(fade_start[0] == 0, "restarted at %u", (unsigned int)fade_start[0]);
+  fades_at(1000);
+  CHECK(get_led_red(0) == 200 && get_led_green(0) == 100 && get_led_blue(0) == 50,
+        "%u, %u, %u at the end", get_led_red(0), get_led_green(0), get_led_blue(0));
+  CHECK(!led_fading(0), "still fading");
+
+  // Once it's there, the same colour over any time leaves it be
+  led_fade_to(0, 200, 100, 50, 300);
+  CHECK(!led_fading(0), "fading again");
+
+  // A new time starts again from where it's got to
+  led_fade_to(0, 0, 0, 0, 1000);
+  fades_at(1500);
+  red = get_led_red(0);
+  led_fade_to(0, 0, 0, 0, 2000);
+  CHECK(fade_start[0] == 1500, "not restarted");
+  fades_at(1500);
+  CHECK(get_led_red(0) == red, "jumped from %u to %u", red, get_led_red(0));
+  fades_at(2500);
+  CHECK(get_led_red(0) > 0 && get_led_red(0) < red, "red %u", get_led_red(0));
+
+  // And 0 switches straight there
+  led_fade_to(0, 0, 0, 0, 0);
+  fades_at(2500);
+  CHECK(get_led_red(0) == 0 && !led_fading(0), "red %u, fading %u", get_led_red(0),
+        led_fading(0));
+
+  // Old style speeds carry on at the speed they were given...
+  led_set_new(1, 255, 0, 0, 1);
+  fades_at(2500 + 100*FADE_STEP_MS);
+  led_set_new(1, 255, 0, 0, 1);
+  CHECK(fade_start[1] == 2500, "speed restarted at %u", (unsigned int)fade_start[1]);
+  // ...but a speed of 0 is still straight there
+  led_set_new(1, 255, 0, 0, 0);
+  fades_at(2500 + 100*FADE_STEP_MS);
+  CHECK(get_led_red(1) == 255 && !led_fading(1), "red %u", get_led_red(1));
+}
+
+int main(int, char **argv) {
+  check_fade_lanes();
+  check_same_colour();
+  return check_done(argv[0]);
+}
@@ -0,0 +1,63 @@
+/*
+ * test_frames.cpp
+ *
+ * Checks that cue timings keep to the clock when frames run long: frames
+ * dropped by wait_for_frame() are still counted by the show (see
+ * CATCH_UP_FRAMES), so a step moves on at its advance_at whether every
+ * frame ran or not.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+// Cue 1's first step, all_on for 2000ms
+#define TEST_CUE		1
+#define STEP_MS			2000
+
+// Calls the cue and runs the show until it moves on to its next step, with
+// every stall_every'th frame running stall frames long (0 for never), and
+// gives back how long that took in milliseconds
+static unsigned long time_step(unsigned int stall_every, unsigned int stall) {
+  unsigned long start;
+
+  while (cue != TEST_CUE - 1) {
+    host_back = 1;
+    loop();
+  }
+  host_back = 0;
+  host_advance = 1;
+  start = millis();
+  for (unsigned int frame = 0; sub_cue == 0 && frame < 10 * STEP_MS / FRAME_MS; frame++) {
+    if (stall_every && frame % stall_every == stall_every - 1) {
+      host_busy(stall * FRAME_US);
+    }
+    loop();
+    host_advance = 0;
+  }
+  return millis() - start;
+}
+
+int main(int, char **argv) {
+  unsigned long ms;
+  unsigned long dropped;
+
+  host_power_on();
+
+  ms = time_step(0, 0);
+  CHECK(ms >= STEP_MS && ms <= STEP_MS + 2*FRAME_MS, "%lums without stalls", ms);
+
+  // Every 10th frame running 3 frames long, so the 2 after it are dropped,
+  // all caught up
+  dropped = frames_dropped;
+  ms = time_step(10, 3);
+  CHECK(frames_dropped - dropped >= 2 * (STEP_MS / FRAME_MS / 12), "only %lu frames dropped",
+        frames_dropped - dropped);
+  CHECK(ms >= STEP_MS && ms <= STEP_MS + 4*FRAME_MS, "%lums with stalls", ms);
+
+  // Dropping more than CATCH_UP_FRAMES leaves the show the rest behind,
+  // here 5 frames
+  ms = time_step(200, CATCH_UP_FRAMES + 6);
+  CHECK(ms >= STEP_MS + 5*FRAME_MS && ms <= STEP_MS + 7*FRAME_MS, "%lums with a long stall", ms);
+
+  return check_done(argv[0]);
+}
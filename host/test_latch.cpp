@@ -0,0 +1,152 @@
+/*
+ * test_latch.cpp
+ *
+ * Runs the sketch against the model of the chain and checks what the
+ * chips actually latch: the dot correction dc_value() gives, every frame
+ * shifted in whole and latched with the outputs blanked, and for a set of
+ * levels exactly the PWM values the sketch meant to send, in the right
+ * channels, and that it stops sending once they stop changing.  Also that seeding the random numbers only writes to EEPROM
+ * with SEED_BOOTS, and then only the bytes that change, and with
+ * FIXTURE_MAP that channel_lane() gives the lane FIXTURES puts each
+ * channel on, and that a single colour fixture is set and read back as one
+ * channel.  Built for each way the sketch can send its data (see
+ * Makefile).
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#define SHOW_SECONDS	120
+#define CUE_SECONDS		10
+
+// Sets every channel to a level of its own and checks the chips end up
+// with the PWM value for it
+static void check_levels(unsigned int seed) {
+  static byte levels[NUM_CHANNELS];
+  static unsigned int expected[16*NUM_TLC];
+
+  srand(seed);
+  host_wait_latched();
+  for (unsigned int channel = 0; channel < NUM_CHANNELS; channel++) {
+    levels[channel] = rand();
+    channel_set(channel, levels[channel]);
+  }
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+#if PWM_DITHER
+    // Plus whatever the channel had left over from its last frame
+    expected[channel] = (pgm_read_word(&PWM_VALUE[levels[channel]])
+      + GET_DITHER_ERROR(channel)) >> PWM_FRACTION_BITS;
+#else
+    expected[channel] = pwm_value(levels[channel]);
+#endif
+  }
+  write_gs_data();
+  host_wait_latched();
+  for (unsigned int channel = 0; channel < 16*NUM_TLC && !CHECK_QUIET(); channel++) {
+    CHECK(tlc_model_gs(channel) == expected[channel], "channel %u level %u: latched %u, sent %u",
+          channel, levels[channel], tlc_model_gs(channel), expected[channel]);
+  }
+}
+
+// Once the channels stop changing, at most one more frame is sent (rounded
+// off, after dithering), the PWM value for each level, and then no more
+static void check_steady() {
+  unsigned long sent;
+
+  write_gs_data();
+  host_wait_latched();
+  sent = gs_frames_sent;
+  for (byte frame = 0; frame < 10; frame++) {
+    write_gs_data();
+  }
+  CHECK(gs_frames_sent == sent, "%lu frames sent with nothing changing", gs_frames_sent - sent);
+  for (unsigned int channel = 0; channel < 16*NUM_TLC && !CHECK_QUIET(); channel++) {
+    CHECK(tlc_model_gs(channel) == pwm_value(grayscale_values[channel]),
+          "channel %u level %u: left at %u", channel, grayscale_values[channel],
+          tlc_model_gs(channel));
+  }
+}
+
+#if FIXTURE_MAP
+// Against looking through the map for the first leg on the channel
+static void check_lanes() {
+  for (unsigned int channel = 0; channel < NUM_CHANNELS; channel++) {
+    byte lane = channel % 3;
+    bool found = false;
+
+    for (unsigned int led = 0; led < NUM_LED && !found; led++) {
+      for (byte leg = 0; leg < 3 && !found; leg++) {
+        found = LED_HAS_LANE(led, leg) && LED_CHANNEL(led, leg) == channel;
+        lane = found ? leg : lane;
+      }
+    }
+    CHECK(channel_lane(channel) == lane, "channel %u in lane %u, not %u", channel,
+          channel_lane(channel), lane);
+  }
+}
+
+// A single colour LED takes its red and reads it back as all three, and
+// set again to the same colour carries on with its fade
+static void check_mono(unsigned int led) {
+  unsigned int start;
+
+  led_set(led, 200, 50, 9);
+  CHECK(grayscale_values[LED_CHANNEL(led, RED_L)] == 200 && get_led_green(led) == 200
+        && get_led_blue(led) == 200, "LED %u is %u, %u, %u", led, get_led_red(led),
+        get_led_green(led), get_led_blue(led));
+  led_fade_to(led, 100, 1, 2, 1000);
+  start = fade_start[led];
+  frame_ms += 100;
+  led_fade_to(led, 100, 3, 4, 1000);
+  CHECK(fade_start[led] == start && get_new_led_blue(led) == 100,
+        "LED %u's fade started again", led);
+  stop_fades();
+}
+#endif
+
+int main(int, char **argv) {
+  unsigned long latches;
+
+  host_power_on();
+#if FIXTURE_MAP
+  check_lanes();
+#if NUM_LED == 12
+  check_mono(10);
+#endif
+#endif
+#if SEED_IN_EEPROM
+  // The power-up count goes from erased to 0, then on to 1 with just its
+  // lowest byte written
+  unsigned long writes = host_eeprom_writes;
+
+  seed_random();
+  CHECK(host_eeprom_writes == writes + 1 && writes == 4, "%lu EEPROM writes at power-up,"
+        " %lu the next", writes, host_eeprom_writes - writes);
+#else
+  CHECK(host_eeprom_writes == 0, "%lu EEPROM writes at power-up", host_eeprom_writes);
+#endif
+  CHECK(tlc_model_dc_latches() == 1, "%lu dot correction latches", tlc_model_dc_latches());
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    CHECK(tlc_model_dc(channel) == dc_value(channel), "channel %u: dot correction %u, not %u",
+          channel, tlc_model_dc(channel), dc_value(channel));
+  }
+  check_levels(1);
+  check_steady();
+
+  // The show, moved on a cue every so often
+  latches = tlc_model_gs_latches();
+  for (unsigned long frame = 0; frame < SHOW_SECONDS * 1000UL / FRAME_MS; frame++) {
+    host_advance = frame % (CUE_SECONDS * 1000UL / FRAME_MS) == 0;
+    loop();
+  }
+  host_advance = 0;
+  CHECK(tlc_model_gs_latches() > latches, "no frames latched during the show");
+  CHECK(tlc_model_running(), "outputs off");
+  check_levels(2);
+
+  CHECK(tlc_model_errors()->short_latches == 0, "%lu latches of part of a frame",
+        tlc_model_errors()->short_latches);
+  CHECK(tlc_model_errors()->unblanked_latches == 0, "%lu latches with the outputs on",
+        tlc_model_errors()->unblanked_latches);
+  return check_done(argv[0]);
+}
@@ -0,0 +1,116 @@
+/*
+ * test_pack.cpp
+ *
+ * Checks that pack_gs_data() and pack_dc_data(), a chunk at a time as
+ * write_gs_data() and write_dc_data() use them, give exactly the bits the
+ * old bit at a time loops shifted out, for random channel values.  Built
+ * for several chain lengths and chunk sizes (see Makefile).
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#include <vector>
+
+#define TRIALS		200
+
+typedef std::vector<byte> bits;
+
+// The bits of data, MSB first, as the SPI or bitbang_shift_out() sends them
+static void append_bytes(bits &out, const byte *data, unsigned int length) {
+  for (unsigned int n = 0; n < length; n++) {
+    for (byte bit = 0x80; bit; bit >>= 1) {
+      out.push_back(data[n] & bit ? 1 : 0);
+    }
+  }
+}
+
+// As the old write_gs_data() loop: for every bit, the channel's value and
+// which of its bits, last channel first and MSB first
+static bits reference_gs(const unsigned int *pwm) {
+  bits out;
+
+  for (unsigned int loop_var = 0; loop_var < NUM_TLC * 16 * 12; loop_var++) {
+    out.push_back(pwm[NUM_TLC*16 - loop_var / 12 - 1] & (2048 >> (loop_var % 12)) ? 1 : 0);
+  }
+  return out;
+}
+
+// As the old write_dc_data() loop, but with each channel's own value
+static bits reference_dc() {
+  bits out;
+
+  for (unsigned int loop_var = 0; loop_var < NUM_TLC * 16 * 6; loop_var++) {
+    out.push_back(dc_value(NUM_TLC*16 - loop_var / 6 - 1) & (32 >> (loop_var % 6)) ? 1 : 0);
+  }
+  return out;
+}
+
+static void check_gs() {
+  static unsigned int pwm[16*NUM_TLC];
+  byte data[24*GS_CHUNK_TLC];
+  unsigned int channels;
+  bits packed;
+
+  for (unsigned int channel = 0; channel < NUM_CHANNELS; channel++) {
+    channel_set_fine(channel, rand());
+  }
+  // What channel_pwm() gives each channel this frame.  With PWM_DITHER that
+  // moves its error on, so it's put back for pack_gs_data().
+#if PWM_DITHER
+  byte error[sizeof(dither_error)];
+
+  memcpy(error, dither_error, sizeof(error));
+#endif
+  for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+    pwm[channel] = channel_pwm(channel);
+  }
+#if PWM_DITHER
+  memcpy(dither_error, error, sizeof(error));
+#endif
+
+  for (unsigned int end = 16*NUM_TLC; end > 0; end -= channels) {
+    channels = min(end, 16*GS_CHUNK_TLC);
+    pack_gs_data(data, end, channels);
+    append_bytes(packed, data, channels / 2 * 3);
+  }
+  CHECK(packed == reference_gs(pwm), "grayscale bits differ");
+}
+
+static void check_dc() {
+  byte data[24*GS_CHUNK_TLC];
+  unsigned int channels;
+  bits packed;
+
+  for (unsigned int end = 16*NUM_TLC; end > 0; end -= channels) {
+    channels = min(end, 16*GS_CHUNK_TLC);
+    pack_dc_data(data, end, channels);
+    append_bytes(packed, data, channels / 4 * 3);
+  }
+  CHECK(packed == reference_dc(), "dot correction bits differ");
+}
+
+int main(int, char **argv) {
+  srand(1);
+  for (unsigned int trial = 0; trial < TRIALS && !CHECK_QUIET(); trial++) {
+#if PWM_DITHER
+    // Dithered as the channels change, and rounded off once they stop
+    gs_dithering = trial & 1;
+#endif
+    check_gs();
+  }
+
+  // The currents for each leg, then random tables
+  load_dc();
+  check_dc();
+  for (unsigned int trial = 0; trial < TRIALS && !CHECK_QUIET(); trial++) {
+    dc_mark(1);
+    for (unsigned int channel = 0; channel < 16*NUM_TLC; channel++) {
+      EEPROM_WRITE(DC_EEPROM + DC_HEADER + channel, rand());
+    }
+    load_dc();
+    CHECK(dc_from_eeprom, "table not taken");
+    check_dc();
+  }
+  return check_done(argv[0]);
+}
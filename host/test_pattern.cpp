@@ -0,0 +1,115 @@
+/*
+ * test_pattern.cpp
+ *
+ * Checks pattern_invert, pattern_shift and binary_counter on ranges longer
+ * than their 16 bit pattern, where the pattern has to repeat rather than
+ * shift past its end, and pattern_shift bouncing on a short range.  Built
+ * for a chain longer than 32 LEDs (see Makefile).
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+static struct effect *fx = &effects[0];
+
+// Starts the effect afresh on count LEDs from first, everything else off
+static void start(unsigned int first, unsigned int count) {
+  led_set_all(0, 0, 0, 0);
+  perform_fades();
+  fx->first = first;
+  fx->count = count;
+  fx->anim_count = 0;
+  assign_colours(fx->colours, BLACK, RED, RED, 0, 1);
+}
+
+static byte lit(unsigned int led) {
+  return get_led_red(led) != 0;
+}
+
+// Which of fx's LEDs are lit, as a pattern, checking the LEDs past the
+// first 16 repeat it and the LEDs either side of the range are off
+static uint16_t lit_pattern() {
+  uint16_t pattern = 0;
+
+  perform_fades();
+  for (unsigned int led = 0; led < NUM_LED; led++) {
+    unsigned int n = led - fx->first;
+
+    if (led < fx->first || n >= fx->count) {
+      CHECK(!lit(led), "LED %u lit, outside %u to %u", led, fx->first,
+            fx->first + fx->count - 1);
+    } else if (n < PATTERN_BITS) {
+      pattern |= lit(led) << n;
+    } else {
+      CHECK(lit(led) == lit(fx->first + n % PATTERN_BITS), "LED %u isn't LED %u again",
+            led, fx->first + n % PATTERN_BITS);
+    }
+  }
+  return pattern;
+}
+
+static void check_invert() {
+  uint16_t pattern;
+
+  start(0, NUM_LED);
+  pattern_invert(fx, 0x8001, 1, 0, 0);
+  pattern_invert(fx, 0x8001, 1, 0, 0);
+  pattern = lit_pattern();
+  CHECK(pattern == 0x8001, "pattern_invert showed %04x", pattern);
+  pattern_invert(fx, 0x8001, 1, 0, 0);
+  pattern = lit_pattern();
+  CHECK(pattern == 0x7FFE, "pattern_invert then showed %04x", pattern);
+}
+
+// Shifting round and round, and bouncing, on a long range and a short one
+static void check_shift(unsigned int first, unsigned int count, uint16_t start_pattern,
+                        int8_t dir, byte bounce) {
+  uint16_t mask = count < PATTERN_BITS ? (1U << count) - 1 : 0xFFFF;
+  uint16_t pattern;
+  uint16_t expected = start_pattern & mask;
+
+  start(first, count);
+  pattern_shift(fx, start_pattern, 1, 0, 0, dir, bounce);
+  for (unsigned int n = 0; n < 100 && !CHECK_QUIET(); n++) {
+    pattern_shift(fx, start_pattern, 1, 0, 0, dir, bounce);
+    pattern = lit_pattern();
+    CHECK(pattern == expected, "%u LEDs from %u, shift %u: %04x, not %04x", count, first, n,
+          pattern, expected);
+    CHECK((fx->s.pattern.pattern & ~mask) == 0, "bits past the range: %04x",
+          fx->s.pattern.pattern);
+    expected = fx->s.pattern.pattern;
+  }
+}
+
+static void check_counter(unsigned int count) {
+  uint16_t top = count < PATTERN_BITS ? (1U << count) - 1 : 0xFFFF;
+  uint16_t pattern;
+  unsigned long n;
+
+  start(0, count);
+  binary_counter(fx, 1, 0, 0);
+  for (n = 0; n <= top && !CHECK_QUIET(); n++) {
+    binary_counter(fx, 1, 0, 0);
+    if (n % 997 == 0 || n + 2 >= top) {
+      pattern = lit_pattern();
+      CHECK(pattern == n, "%u LEDs, count %lu showed %04x", count, n, pattern);
+    }
+  }
+  // Then back down
+  binary_counter(fx, 1, 0, 0);
+  pattern = lit_pattern();
+  CHECK(pattern == top - 1, "%u LEDs, turned at %04x", count, pattern);
+}
+
+int main(int, char **argv) {
+  host_power_on();
+  check_invert();
+  check_shift(0, NUM_LED, 0x0007, 1, 0);
+  check_shift(0, NUM_LED, 0x8003, BACKWARDS, 0);
+  check_shift(3, 5, 0x0003, 1, 1);
+  check_shift(3, 5, 0xFFE3, BACKWARDS, 1);
+  check_shift(2, 20, 0x0700, 1, 1);
+  check_counter(5);
+  check_counter(NUM_LED);
+  return check_done(argv[0]);
+}
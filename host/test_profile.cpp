@@ -0,0 +1,74 @@
+/*
+ * test_profile.cpp
+ *
+ * Runs the show with PROFILE, asks for a profile record over serial as the
+ * PC would, and checks what profile_decode() makes of it: the right frame
+ * counts and rate, and each stage's figures adding up.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+#include "profile.h"
+
+#define RECORD_FRAMES	500
+
+// Runs frames frames of the show
+static void run(unsigned int frames) {
+  for (unsigned int frame = 0; frame < frames; frame++) {
+    host_advance = frame == 0;
+    loop();
+  }
+  host_advance = 0;
+}
+
+static void check_stage(const struct profile_record *p, byte stage) {
+  const struct profile_stage *s = &p->stage[stage];
+  unsigned long counted = 0;
+
+  for (byte bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+    counted += s->hist[bucket];
+  }
+  CHECK(counted == s->count, "%s: %lu in the histogram, %lu timed",
+        PROFILE_STAGE_NAMES[stage], counted, (unsigned long)s->count);
+  CHECK(s->min <= s->max && (unsigned long)s->min * s->count <= s->total
+        && s->total <= (unsigned long)s->max * s->count, "%s: min %u max %u total %lu",
+        PROFILE_STAGE_NAMES[stage], s->min, s->max, (unsigned long)s->total);
+}
+
+int main(int, char **argv) {
+  const byte *raw;
+  struct profile_record record = {};
+
+  host_power_on();
+  run(RECORD_FRAMES);
+  host_serial_out.clear();
+  host_serial_in.push_back(PROFILE_REQUEST);
+  // A few bytes go each frame
+  run(PROFILE_RECORD_BYTES);
+  raw = (const byte *)host_serial_out.data();
+
+  CHECK(host_serial_out.size() == PROFILE_RECORD_BYTES, "%u bytes sent",
+        (unsigned int)host_serial_out.size());
+  CHECK(!profile_decode(raw, PROFILE_RECORD_BYTES - 1, &record), "short record decoded");
+  CHECK(profile_decode(raw, host_serial_out.size(), &record), "record not decoded");
+
+  CHECK(record.stage[PROFILE_FRAME].count >= RECORD_FRAMES, "%lu frames timed",
+        (unsigned long)record.stage[PROFILE_FRAME].count);
+  CHECK(record.frames_run >= record.stage[PROFILE_FRAME].count, "%lu frames run",
+        (unsigned long)record.frames_run);
+  CHECK(record.stage[PROFILE_ANIMATE].count == record.stage[PROFILE_FRAME].count
+        && record.stage[PROFILE_UPLOAD].count == record.stage[PROFILE_FRAME].count,
+        "stages timed different numbers of frames");
+  // Nothing overruns on the made up clock, so it's exactly FRAME_MS a frame
+  CHECK(record.fps_x100 >= 99000 / FRAME_MS && record.fps_x100 <= 101000 / FRAME_MS,
+        "%u fps x 100", record.fps_x100);
+  CHECK(record.gs_frames_sent + record.gs_frames_skipped >= record.stage[PROFILE_FRAME].count,
+        "%lu sent, %lu skipped", (unsigned long)record.gs_frames_sent,
+        (unsigned long)record.gs_frames_skipped);
+  CHECK(record.gs_latches > 0 && record.gs_latches <= record.gs_frames_sent, "%lu latched",
+        (unsigned long)record.gs_latches);
+  for (byte stage = 0; stage < PROFILE_STAGES; stage++) {
+    check_stage(&record, stage);
+  }
+  return check_done(argv[0]);
+}
@@ -0,0 +1,100 @@
+/*
+ * test_render.cpp
+ *
+ * Checks render against the sketch's own preview: cue 1, rendered a pixel
+ * an LED in a row (layouts/row.layout) as PPM and PNG, has to be every
+ * frame the preview sent over serial as the board started up, and so
+ * does the same piped to stdout as raw RGB.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#define RENDERED		"build/frames/row"
+#define PIPED			RENDERED "/piped.rgb"
+#define FRAME_BYTES		(3*NUM_LED)
+
+// The pixels of a PPM from render
+static bool read_ppm(const char *path, byte *pixels) {
+  FILE *f = fopen(path, "rb");
+  unsigned int width;
+  unsigned int height;
+  bool ok;
+
+  if (!f) {
+    return false;
+  }
+  ok = fscanf(f, "P6 %u %u 255", &width, &height) == 2 && fgetc(f) == '\n'
+    && width == NUM_LED && height == 1 && fread(pixels, 1, FRAME_BYTES, f) == FRAME_BYTES
+    && fgetc(f) == EOF;
+  fclose(f);
+  return ok;
+}
+
+// The pixels of a PNG from render, which are stored as they are: the one
+// row after its filter byte, in the one deflate block
+static bool read_png(const char *path, byte *pixels) {
+  static const byte start[16] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n',
+                                 0, 0, 0, 13, 'I', 'H', 'D', 'R'};
+  FILE *f = fopen(path, "rb");
+  byte png[256];
+  unsigned int length;
+  const byte *idat;
+
+  if (!f) {
+    return false;
+  }
+  length = fread(png, 1, sizeof(png), f);
+  fclose(f);
+  // Signature, IHDR, then IDAT: length, type, zlib header, block header,
+  // filter byte
+  idat = png + 33;
+  if (length < 33 + 8 + 2 + 5 + 1 + FRAME_BYTES || memcmp(png, start, sizeof(start)) != 0
+      || png[19] != NUM_LED || png[23] != 1 || memcmp(idat + 4, "IDAT", 4) != 0
+      || idat[10] != 1 || idat[15] != 0) {
+    return false;
+  }
+  memcpy(pixels, idat + 16, FRAME_BYTES);
+  return true;
+}
+
+// Everything render wrote to stdout
+static std::string read_piped() {
+  FILE *f = fopen(PIPED, "rb");
+  std::string piped;
+  int c;
+
+  if (!f) {
+    return piped;
+  }
+  while ((c = fgetc(f)) != EOF) {
+    piped += (char)c;
+  }
+  fclose(f);
+  return piped;
+}
+
+int main(int, char **argv) {
+  byte pixels[FRAME_BYTES];
+  char path[256];
+
+  // setup() runs the preview
+  host_power_on();
+  CHECK(host_serial_out.size() == (unsigned long)PREVIEW_FRAMES * FRAME_BYTES,
+        "preview sent %u bytes", (unsigned int)host_serial_out.size());
+  for (unsigned int frame = 0; frame < PREVIEW_FRAMES && !CHECK_QUIET(); frame++) {
+    const char *sent = host_serial_out.data() + frame * FRAME_BYTES;
+
+    snprintf(path, sizeof(path), RENDERED "/frame_%05u.ppm", frame);
+    CHECK(read_ppm(path, pixels), "%s isn't a %ux1 PPM", path, NUM_LED);
+    CHECK(memcmp(pixels, sent, FRAME_BYTES) == 0, "frame %u differs from the preview", frame);
+    snprintf(path, sizeof(path), RENDERED "/frame_%05u.png", frame);
+    CHECK(read_png(path, pixels), "%s isn't a %ux1 PNG", path, NUM_LED);
+    CHECK(memcmp(pixels, sent, FRAME_BYTES) == 0, "PNG frame %u differs from the preview",
+          frame);
+  }
+  snprintf(path, sizeof(path), RENDERED "/frame_%05u.ppm", PREVIEW_FRAMES);
+  CHECK(!read_ppm(path, pixels), "more frames rendered than previewed");
+  CHECK(read_piped() == host_serial_out, "%s isn't the frames previewed", PIPED);
+  return check_done(argv[0]);
+}
@@ -0,0 +1,130 @@
+/*
+ * test_show.cpp
+ *
+ * Checks the show file: that shows/demo.show, compiled by showc, is
+ * CUE_STEPS step for step, that its bytes are where the Cue List says they
+ * are, that the sketch plays it from the card and won't play a file of
+ * another version, and that a cue called again after one that isn't there
+ * starts afresh.
+ */
+
+#include "sketch.inc"
+#include "check.h"
+
+#define DEMO_SHOW	"build/demo.bin"
+#define OLD_SHOW	"build/old.bin"
+
+static struct cue_step flash_step(unsigned int n) {
+  struct cue_step step;
+
+  memcpy_P(&step, &CUE_STEPS[n], sizeof(step));
+  return step;
+}
+
+// The file as it is, against the sketch's own steps packed up
+static void check_file() {
+  FILE *f = fopen(DEMO_SHOW, "rb");
+  byte header[SHOW_HEADER];
+  byte raw[SHOW_STEP_BYTES];
+  byte expected[SHOW_STEP_BYTES];
+
+  CHECK(f, "no %s", DEMO_SHOW);
+  if (!f) {
+    return;
+  }
+  CHECK(fread(header, 1, SHOW_HEADER, f) == SHOW_HEADER, "no header");
+  CHECK(memcmp(header, "TLCS", 4) == 0 && header[4] == SHOW_VERSION
+        && header[5] == SHOW_STEP_BYTES, "header %02x %02x", header[4], header[5]);
+  CHECK(header[6] + 256 * header[7] == NUM_STEPS, "%u steps, not %u",
+        header[6] + 256 * header[7], (unsigned int)NUM_STEPS);
+  for (unsigned int n = 0; n < NUM_STEPS && !CHECK_QUIET(); n++) {
+    struct cue_step step = flash_step(n);
+
+    CHECK(fread(raw, 1, SHOW_STEP_BYTES, f) == SHOW_STEP_BYTES, "step %u missing", n);
+    step_encode(&step, expected);
+    CHECK(memcmp(raw, expected, SHOW_STEP_BYTES) == 0, "step %u differs", n);
+  }
+  CHECK(fgetc(f) == EOF, "more after the last step");
+  fclose(f);
+
+  // Cue 3's pattern_shift, by hand
+  struct cue_step step = flash_step(6);
+
+  step_encode(&step, raw);
+  CHECK(step.effect == EFFECT_PATTERN_SHIFT, "step 6 is effect %u", step.effect);
+  CHECK(raw[0] == 0xC0 && raw[1] == 0x5D && raw[2] == 0 && raw[3] == 0, "advance_at");
+  CHECK(raw[4] == STEP_COLOURS, "flags %02x", raw[4]);
+  CHECK(raw[5] == 0 && raw[11] == 255 && raw[14] == 4 && raw[15] == 255, "colours");
+  CHECK(raw[16] == EFFECT_PATTERN_SHIFT, "effect %u", raw[16]);
+  CHECK(raw[17] == 0xC0 && raw[18] == 0x01, "pattern %02x %02x", raw[17], raw[18]);
+  CHECK(raw[19] == 9 && raw[22] == 1 && raw[23] == 1, "args");
+  CHECK(raw[39] == 0, "spare %u", raw[39]);
+}
+
+// What the sketch reads back from the card
+static void check_played() {
+  struct cue_step step;
+  byte read[SHOW_STEP_BYTES];
+  byte expected[SHOW_STEP_BYTES];
+
+  CHECK(show_on_sd, "show not taken from the card");
+  CHECK(show_steps == NUM_STEPS, "%u steps", show_steps);
+  for (unsigned int n = 0; n < NUM_STEPS && !CHECK_QUIET(); n++) {
+    struct cue_step flash = flash_step(n);
+
+    CHECK(read_step(n, &step), "step %u not read", n);
+    step_encode(&step, read);
+    step_encode(&flash, expected);
+    CHECK(memcmp(read, expected, SHOW_STEP_BYTES) == 0, "step %u read back differently", n);
+    CHECK(step_flags(n) == flash.flags, "step %u flags %02x", n, step_flags(n));
+  }
+  CHECK(find_cue(3) == 5 && find_cue(1000) == NO_STEP, "cue 3 at step %u", find_cue(3));
+}
+
+// Cue 1, then a cue the show doesn't have, then cue 1 again: the second
+// time round it's loaded again, with new random streams
+static void check_missing_cue() {
+  unsigned int groups;
+
+  cue = 1;
+  sub_cue = 0;
+  loop();
+  groups = groups_started;
+  CHECK(loaded_step == find_cue(1), "cue 1 not loaded");
+  cue = 1000;
+  loop();
+  CHECK(loaded_step == NO_STEP, "step %u still loaded", loaded_step);
+  cue = 1;
+  sub_cue = 0;
+  restart_effects();
+  loop();
+  CHECK(loaded_step == find_cue(1) && groups_started == groups + 1,
+        "cue 1 not loaded again (%u groups started)", groups_started - groups);
+}
+
+// A file from before the steps were laid out byte by byte
+static void check_old_version() {
+  FILE *f = fopen(OLD_SHOW, "wb");
+  byte header[SHOW_HEADER] = {'T', 'L', 'C', 'S', 4, sizeof(struct cue_step), 1, 0};
+  struct cue_step step = flash_step(0);
+
+  fwrite(header, 1, SHOW_HEADER, f);
+  fwrite(&step, 1, sizeof(step), f);
+  fclose(f);
+  host_show_path = OLD_SHOW;
+  show_on_sd = 0;
+  show_steps = NUM_STEPS;
+  open_show(init_sd());
+  CHECK(!show_on_sd, "version 4 file played");
+  remove(OLD_SHOW);
+}
+
+int main(int, char **argv) {
+  check_file();
+  host_show_path = DEMO_SHOW;
+  host_power_on();
+  check_played();
+  check_missing_cue();
+  check_old_version();
+  return check_done(argv[0]);
+}
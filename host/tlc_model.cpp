@@ -0,0 +1,165 @@
+/*
+ * tlc_model.cpp
+ *
+ * See tlc_model.h.
+ */
+
+#include "tlc_model.h"
+
+#include <vector>
+
+#define GS_BITS			192
+#define DC_BITS			96
+
+namespace {
+
+struct chain {
+  // The shift register, a ring: bit head is the last one shifted in, head
+  // - 1 the one before, and so on back round
+  std::vector<uint8_t> shift;
+  unsigned int head;
+  std::vector<uint16_t> gs;
+  std::vector<uint8_t> dc;
+};
+
+std::vector<chain> chains;
+unsigned int chain_tlc;
+
+unsigned int sin_bits;
+int sclk, xlat, vprg, blank;
+int gsclk_on, blank_on;
+unsigned long bits_since_latch;
+unsigned long sclks, gs_latches, dc_latches;
+tlc_errors errors;
+
+// Bit n back from the last one shifted into c (0 is the last)
+int shifted(const chain &c, unsigned int n) {
+  unsigned int size = c.shift.size();
+
+  return c.shift[(c.head + size - n % size) % size];
+}
+
+// The width bit value for channel (of the chain) from the register, MSB
+// shifted in first
+unsigned int channel_bits(const chain &c, unsigned int channel, unsigned int width) {
+  unsigned int value = 0;
+
+  for (unsigned int bit = width; bit-- > 0; ) {
+    value = (value << 1) | shifted(c, channel * width + bit);
+  }
+  return value;
+}
+
+void latch() {
+  unsigned long needed = (vprg ? DC_BITS : GS_BITS) * (unsigned long)chain_tlc;
+
+  if (bits_since_latch < needed) {
+    errors.short_latches++;
+  }
+  if (!vprg && blank_on && !blank) {
+    errors.unblanked_latches++;
+  }
+  for (chain &c : chains) {
+    for (unsigned int channel = 0; channel < 16*chain_tlc; channel++) {
+      if (vprg) {
+        c.dc[channel] = channel_bits(c, channel, 6);
+      } else {
+        c.gs[channel] = channel_bits(c, channel, 12);
+      }
+    }
+  }
+  if (vprg) {
+    dc_latches++;
+  } else {
+    gs_latches++;
+  }
+  bits_since_latch = 0;
+}
+
+}
+
+void tlc_model_begin(unsigned int num_chains, unsigned int tlc_per_chain) {
+  chains.assign(num_chains, chain());
+  chain_tlc = tlc_per_chain;
+  for (chain &c : chains) {
+    c.shift.assign(GS_BITS * tlc_per_chain, 0);
+    c.head = 0;
+    c.gs.assign(16 * tlc_per_chain, 0);
+    c.dc.assign(16 * tlc_per_chain, 0);
+  }
+  sin_bits = 0;
+  sclk = xlat = vprg = blank = 0;
+  gsclk_on = blank_on = 0;
+  bits_since_latch = 0;
+  sclks = gs_latches = dc_latches = 0;
+  errors = tlc_errors();
+}
+
+void tlc_model_sin(unsigned int bits) {
+  sin_bits = bits;
+}
+
+void tlc_model_sclk(int high) {
+  if (high && !sclk) {
+    for (unsigned int n = 0; n < chains.size(); n++) {
+      chain &c = chains[n];
+
+      c.head = (c.head + 1) % c.shift.size();
+      c.shift[c.head] = (sin_bits >> n) & 1;
+    }
+    bits_since_latch++;
+    sclks++;
+  }
+  sclk = high;
+}
+
+void tlc_model_xlat(int high) {
+  if (high && !xlat) {
+    latch();
+  }
+  xlat = high;
+}
+
+void tlc_model_vprg(int high) {
+  vprg = high;
+}
+
+void tlc_model_blank(int high) {
+  blank = high;
+}
+
+void tlc_model_gsclk_toggle() {
+  gsclk_on ^= 1;
+}
+
+void tlc_model_blank_toggle() {
+  blank_on ^= 1;
+}
+
+unsigned int tlc_model_gs(unsigned int channel) {
+  return chains[channel / (16*chain_tlc)].gs[channel % (16*chain_tlc)];
+}
+
+unsigned int tlc_model_dc(unsigned int channel) {
+  return chains[channel / (16*chain_tlc)].dc[channel % (16*chain_tlc)];
+}
+
+unsigned long tlc_model_gs_latches() {
+  return gs_latches;
+}
+
+unsigned long tlc_model_dc_latches() {
+  return dc_latches;
+}
+
+unsigned long tlc_model_sclks() {
+  return sclks;
+}
+
+const struct tlc_errors *tlc_model_errors() {
+  return &errors;
+}
+
+int tlc_model_running() {
+  return gsclk_on && blank_on && !blank;
+}
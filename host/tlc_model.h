@@ -0,0 +1,61 @@
+/*
+ * tlc_model.h
+ *
+ * A model of one or more chains of TLC5940s, driven through the lines the
+ * sketch drives (see hal_host.h), for checking what actually ends up in
+ * the chips.
+ *
+ * Each chip has a 192 bit input shift register (96 bits of it in dot
+ * correction mode), shifted on the rising edge of SCLK, with the chip
+ * nearest the board first in the chain.  On the rising edge of XLAT the
+ * register is latched into the grayscale registers, or with VPRG high the
+ * dot correction registers.  Channels are numbered as the sketch numbers
+ * them: on from the end of one chain to the start of the next.
+ *
+ * Anything the real chips wouldn't take is counted in tlc_model_errors:
+ * a latch with fewer bits shifted in since the last one than the chain
+ * holds, or a grayscale latch while the outputs are on (BLANK low).
+ */
+
+#ifndef TLC_MODEL_H
+#define TLC_MODEL_H
+
+#include <stdint.h>
+
+struct tlc_errors {
+  // Latches with fewer bits shifted in than the register holds
+  unsigned long short_latches;
+  // Grayscale latches while BLANK was low and the outputs were running
+  unsigned long unblanked_latches;
+};
+
+// Sets up chains chains of tlc_per_chain chips each, all registers 0
+void tlc_model_begin(unsigned int chains, unsigned int tlc_per_chain);
+
+// The lines.  SIN of chain n is bit n of tlc_model_sin().
+void tlc_model_sin(unsigned int bits);
+void tlc_model_sclk(int high);
+void tlc_model_xlat(int high);
+void tlc_model_vprg(int high);
+void tlc_model_blank(int high);
+// GSCLK and BLANK are started and stopped by making their pins outputs
+void tlc_model_gsclk_toggle();
+void tlc_model_blank_toggle();
+
+// What channel has latched in its grayscale (12 bit) and dot correction
+// (6 bit) registers
+unsigned int tlc_model_gs(unsigned int channel);
+unsigned int tlc_model_dc(unsigned int channel);
+
+// How many grayscale and dot correction latches there have been, and how
+// many rising edges of SCLK
+unsigned long tlc_model_gs_latches();
+unsigned long tlc_model_dc_latches();
+unsigned long tlc_model_sclks();
+
+const struct tlc_errors *tlc_model_errors();
+
+// Whether BLANK and GSCLK are both running, i.e. the outputs are lit
+int tlc_model_running();
+
+#endif